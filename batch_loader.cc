@@ -0,0 +1,523 @@
+//
+// Filename     : batch_loader.cc
+// Description  : Prefetching batch assembler over the binary graph store
+// Revision     : $Id:$
+//
+// Compile as a shared library next to batch_loader.py, which then uses it in BatchLoader:
+//
+//   g++ -O2 -shared -fPIC -pthread batch_loader.cc -o libbatchloader.so
+//
+// The graph store (written by batch_loader.write_graph_store) is memory mapped, so only the
+// pages of the graphs being assembled are resident. Worker threads claim batches in order,
+// draw their graphs (an epoch permutation, or weighted sampling with replacement, both from
+// counter-based random streams so that the batches do not depend on the thread schedule),
+// and write them into a ring of aligned slots that are reused for the whole run. The
+// consumer holds one slot while the others are filled, so with numSlot >= 2 the next
+// batches are assembled while the current one is in use. A loader opened with
+// batch_loader_open_fed instead assembles the batches submitted by the caller (e.g. the
+// graphs of the pairs drawn by pair_sampler.HardPairSampler), in the order of submission.
+//
+// Store layout (little endian):
+//
+//   char magic[4] = "D2DG"; uint32 version = 1; uint32 numGraph; uint32 numFeature;
+//   uint64 numEdge; int32 numNode[numGraph]; int32 label[numGraph];
+//   uint64 edgeStart[numGraph+1]; int32 edgeNode[numEdge][2];
+//   float32 edgeValue[numEdge][numFeature]
+//
+// optionally followed by the spectral features of batch_loader.store_spectral_features.
+//
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+///
+/// @brief splitmix64 stream, reproduced by batch_loader.py for the fallback path.
+///
+struct Random {
+  uint64_t state;
+  Random(uint64_t seed, uint64_t stream) : state(seed ^ (stream*0xD1B54A32D192ED03ULL)) {}
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  /// Integer in [0,n)
+  uint64_t below(uint64_t n) { return uint64_t((unsigned __int128)(next())*n >> 64); }
+  /// Double in [0,1)
+  double uniform() { return double(next() >> 11)*(1.0/9007199254740992.0); }
+};
+
+enum Mode { denseAdjacency = 0, denseLaplacian = 1, packedLaplacian = 2 };
+
+struct Slot {
+  float *data;
+  std::vector<int> label, numNode, index;
+  int count;
+  long batch;
+};
+
+class BatchLoader {
+public:
+  BatchLoader() : map_(0), mapSize_(0) {}
+  ~BatchLoader();
+  bool open(const char *fileName);
+  bool start(const int *index, int numIndex, int batchSize, int mode, int column, int size,
+	     int shuffle, const double *weight, int dropLast, uint64_t seed, int numThread,
+	     int numSlot, bool fed);
+  bool submit(const int *item, int count);
+  int next(float **data, int **label, int **numNode, int **index);
+
+  long numBatch() const { return numBatch_; }
+  double stall()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stall_;
+  }
+
+private:
+  void work();
+  std::shared_ptr<const std::vector<int> > permutation(long epoch);
+  void items(long batch, std::vector<int> &item);
+  void fill(long batch, Slot &slot, std::vector<int> &item, std::vector<float> &scratch);
+  void laplacian(int g, std::vector<float> &A, float *out);
+
+  // store
+  void *map_;
+  size_t mapSize_;
+  uint32_t numGraph_, numFeature_;
+  const int32_t *graphNode_, *graphLabel_, *edgeNode_;
+  const uint64_t *edgeStart_;
+  const float *edgeValue_;
+
+  // batches
+  std::vector<int> index_;
+  std::vector<double> cumulative_;
+  int batchSize_, mode_, column_, size_, shuffle_;
+  size_t itemSize_;
+  uint64_t seed_;
+  long numBatch_;
+  std::map<long, std::shared_ptr<const std::vector<int> > > permutation_;
+  // submitted batches of a fed loader, and the graphs they may hold
+  bool fed_ = false;
+  std::vector<char> allowed_;
+  std::map<long, std::vector<int> > submitted_;
+  long numSubmitted_ = 0;
+
+  // ring of slots and workers
+  std::vector<Slot> slot_;
+  std::vector<std::thread> thread_;
+  std::mutex mutex_;
+  std::condition_variable slotFree_, batchReady_;
+  long claimed_ = 0, released_ = 0, current_ = -1;
+  bool stop_ = false;
+  double stall_ = 0.0;
+};
+
+BatchLoader::~BatchLoader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  slotFree_.notify_all();
+  for (size_t t=0; t<thread_.size(); ++t)
+    thread_[t].join();
+  for (size_t s=0; s<slot_.size(); ++s)
+    std::free(slot_[s].data);
+  if (map_)
+    munmap(map_, mapSize_);
+}
+
+bool BatchLoader::open(const char *fileName)
+{
+  int fd = ::open(fileName, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << "batch_loader: Cannot open " << fileName << std::endl;
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  mapSize_ = size_t(st.st_size);
+  map_ = mapSize_ >= 24 ? mmap(0, mapSize_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (map_ == MAP_FAILED) {
+    map_ = 0;
+    std::cerr << "batch_loader: Cannot map " << fileName << std::endl;
+    return false;
+  }
+  const char *p = static_cast<const char*>(map_);
+  uint32_t version;
+  uint64_t numEdge;
+  std::memcpy(&version, p+4, 4);
+  std::memcpy(&numGraph_, p+8, 4);
+  std::memcpy(&numFeature_, p+12, 4);
+  std::memcpy(&numEdge, p+16, 8);
+  size_t expected = 24 + 8*size_t(numGraph_) + 8*(size_t(numGraph_)+1) +
+    numEdge*(8 + 4*size_t(numFeature_));
+  // spectral features (batch_loader.store_spectral_features) may follow the graphs
+  if (std::memcmp(p, "D2DG", 4) != 0 || version != 1 || expected > mapSize_) {
+    std::cerr << "batch_loader: " << fileName << " is not a version 1 graph store" << std::endl;
+    return false;
+  }
+  graphNode_ = reinterpret_cast<const int32_t*>(p+24);
+  graphLabel_ = graphNode_ + numGraph_;
+  edgeStart_ = reinterpret_cast<const uint64_t*>(graphLabel_ + numGraph_);
+  edgeNode_ = reinterpret_cast<const int32_t*>(edgeStart_ + numGraph_ + 1);
+  edgeValue_ = reinterpret_cast<const float*>(edgeNode_ + 2*numEdge);
+  return true;
+}
+
+bool BatchLoader::start(const int *index, int numIndex, int batchSize, int mode, int column,
+			int size, int shuffle, const double *weight, int dropLast, uint64_t seed,
+			int numThread, int numSlot, bool fed)
+{
+  if (numIndex < 1 || batchSize < 1 || mode < denseAdjacency || mode > packedLaplacian ||
+      column >= int(numFeature_) || (mode != denseAdjacency && column < 0)) {
+    std::cerr << "batch_loader: Invalid batch options" << std::endl;
+    return false;
+  }
+  index_.assign(index, index+numIndex);
+  allowed_.assign(numGraph_, 0);
+  for (int i=0; i<numIndex; ++i) {
+    int g = index_[i];
+    if (g < 0 || g >= int(numGraph_) || graphNode_[g] > size) {
+      std::cerr << "batch_loader: Graph " << g << " missing or larger than " << size << std::endl;
+      return false;
+    }
+    allowed_[g] = 1;
+    for (uint64_t e=edgeStart_[g]; e<edgeStart_[g+1]; ++e)
+      if (edgeNode_[2*e] < 0 || edgeNode_[2*e] >= size ||
+	  edgeNode_[2*e+1] < 0 || edgeNode_[2*e+1] >= size) {
+	std::cerr << "batch_loader: Edge of graph " << g << " outside " << size << " nodes"
+		  << std::endl;
+	return false;
+      }
+  }
+  if (weight) {
+    cumulative_.resize(numIndex);
+    double sum = 0.0;
+    for (int i=0; i<numIndex; ++i)
+      cumulative_[i] = (sum += weight[i]);
+    if (!(sum > 0.0)) {
+      std::cerr << "batch_loader: Sampling weights sum to zero" << std::endl;
+      return false;
+    }
+  }
+  batchSize_ = batchSize;
+  mode_ = mode;
+  column_ = column;
+  size_ = size;
+  shuffle_ = shuffle;
+  seed_ = seed;
+  fed_ = fed;
+  numBatch_ = fed ? 0 : dropLast && numIndex >= batchSize ? numIndex/batchSize :
+    (numIndex+batchSize-1)/batchSize;
+  itemSize_ = mode == packedLaplacian ? size_t(size)*(size+1)/2 :
+    size_t(size)*size*(mode == denseAdjacency && column < 0 ? numFeature_ : 1);
+
+  if (numThread <= 0)
+    numThread = std::max(1u, std::thread::hardware_concurrency());
+  if (numSlot < 2)
+    numSlot = numThread+1;
+  numSlot = std::max(numSlot, 2);
+  // 64 byte aligned rows of whole batches, reused for the whole run
+  size_t bytes = (itemSize_*batchSize*sizeof(float) + 63)/64*64;
+  slot_.resize(numSlot);
+  for (int s=0; s<numSlot; ++s) {
+    slot_[s].data = static_cast<float*>(std::aligned_alloc(64, bytes));
+    slot_[s].label.resize(batchSize);
+    slot_[s].numNode.resize(batchSize);
+    slot_[s].index.resize(batchSize);
+    slot_[s].count = 0;
+    slot_[s].batch = -1;
+  }
+  for (int t=0; t<numThread; ++t)
+    thread_.push_back(std::thread(&BatchLoader::work, this));
+  return true;
+}
+
+bool BatchLoader::submit(const int *item, int count)
+{
+  if (!fed_ || count < 1 || count > batchSize_) {
+    std::cerr << "batch_loader: Cannot submit a batch of " << count << " graphs" << std::endl;
+    return false;
+  }
+  for (int i=0; i<count; ++i)
+    if (item[i] < 0 || item[i] >= int(numGraph_) || !allowed_[item[i]]) {
+      std::cerr << "batch_loader: Graph " << item[i] << " not in the index" << std::endl;
+      return false;
+    }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    submitted_[numSubmitted_++].assign(item, item+count);
+  }
+  slotFree_.notify_all();
+  return true;
+}
+
+std::shared_ptr<const std::vector<int> > BatchLoader::permutation(long epoch)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::shared_ptr<const std::vector<int> > &p = permutation_[epoch];
+  if (!p) {
+    // Fisher-Yates on stream 2*epoch
+    std::vector<int> *order = new std::vector<int>(index_);
+    Random random(seed_, 2*uint64_t(epoch));
+    for (size_t i=order->size()-1; i>0; --i)
+      std::swap((*order)[i], (*order)[random.below(i+1)]);
+    p.reset(order);
+    // older epochs are only kept alive by workers still using them
+    permutation_.erase(permutation_.begin(), permutation_.lower_bound(epoch-1));
+  }
+  return p;
+}
+
+void BatchLoader::items(long batch, std::vector<int> &item)
+{
+  if (fed_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<long, std::vector<int> >::iterator s = submitted_.find(batch);
+    item.swap(s->second);
+    submitted_.erase(s);
+    return;
+  }
+  long epoch = batch/numBatch_;
+  size_t begin = size_t(batch%numBatch_)*batchSize_;
+  size_t count = std::min(size_t(batchSize_), index_.size()-begin);
+  item.resize(count);
+  if (!cumulative_.empty()) {
+    // weighted sampling with replacement on stream 2*batch+1
+    Random random(seed_, 2*uint64_t(batch)+1);
+    for (size_t i=0; i<count; ++i) {
+      size_t k = std::upper_bound(cumulative_.begin(), cumulative_.end(),
+				  random.uniform()*cumulative_.back()) - cumulative_.begin();
+      item[i] = index_[std::min(k, index_.size()-1)];
+    }
+  }
+  else if (shuffle_) {
+    std::shared_ptr<const std::vector<int> > order = permutation(epoch);
+    std::copy(order->begin()+begin, order->begin()+begin+count, item.begin());
+  }
+  else
+    std::copy(index_.begin()+begin, index_.begin()+begin+count, item.begin());
+}
+
+void BatchLoader::laplacian(int g, std::vector<float> &A, float *out)
+{
+  // As laplModelForward: A = sign(w), L = A - diag(sum_j (|A_ij| + |A_ji|)/2)
+  size_t n = size_;
+  std::fill(A.begin(), A.end(), 0.0f);
+  for (uint64_t e=edgeStart_[g]; e<edgeStart_[g+1]; ++e)
+    A[edgeNode_[2*e]*n + edgeNode_[2*e+1]] += edgeValue_[e*numFeature_ + column_];
+  for (size_t k=0; k<n*n; ++k)
+    A[k] = float((A[k] > 0.0f) - (A[k] < 0.0f));
+  for (size_t i=0; i<n; ++i) {
+    float degree = 0.0f;
+    for (size_t j=0; j<n; ++j)
+      degree += 0.5f*(std::abs(A[i*n+j]) + std::abs(A[j*n+i]));
+    if (mode_ == packedLaplacian) {
+      // lower triangle, row by row (the part read by eigvalsh)
+      float *row = out + i*(i+1)/2;
+      std::copy(A.begin()+i*n, A.begin()+i*n+i+1, row);
+      row[i] -= degree;
+    }
+    else {
+      std::copy(A.begin()+i*n, A.begin()+(i+1)*n, out + i*n);
+      out[i*n+i] -= degree;
+    }
+  }
+}
+
+void BatchLoader::fill(long batch, Slot &slot, std::vector<int> &item, std::vector<float> &scratch)
+{
+  items(batch, item);
+  for (size_t b=0; b<item.size(); ++b) {
+    int g = item[b];
+    float *out = slot.data + b*itemSize_;
+    slot.index[b] = g;
+    slot.label[b] = graphLabel_[g];
+    slot.numNode[b] = graphNode_[g];
+    if (mode_ != denseAdjacency) {
+      laplacian(g, scratch, out);
+      continue;
+    }
+    // duplicate edges add up, as in the dense form of the sparse COO tensors
+    std::fill(out, out+itemSize_, 0.0f);
+    for (uint64_t e=edgeStart_[g]; e<edgeStart_[g+1]; ++e) {
+      size_t k = size_t(edgeNode_[2*e])*size_ + edgeNode_[2*e+1];
+      const float *value = edgeValue_ + e*numFeature_;
+      if (column_ >= 0)
+	out[k] += value[column_];
+      else
+	for (uint32_t f=0; f<numFeature_; ++f)
+	  out[k*numFeature_+f] += value[f];
+    }
+  }
+  slot.count = int(item.size());
+}
+
+void BatchLoader::work()
+{
+  std::vector<int> item;
+  std::vector<float> scratch(mode_ == denseAdjacency ? 0 : size_t(size_)*size_);
+  for (;;) {
+    long batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stop_)
+	return;
+      batch = claimed_++;
+      // a fed loader also waits for the batch to be submitted
+      slotFree_.wait(lock, [&]() {
+	  return stop_ || (batch < released_ + long(slot_.size()) &&
+			   (!fed_ || batch < numSubmitted_));
+	});
+      if (stop_)
+	return;
+    }
+    Slot &slot = slot_[batch%slot_.size()];
+    fill(batch, slot, item, scratch);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      slot.batch = batch;
+    }
+    batchReady_.notify_all();
+  }
+}
+
+int BatchLoader::next(float **data, int **label, int **numNode, int **index)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  // the slot handed out last time is given back to the workers
+  if (current_ >= 0) {
+    released_ = current_+1;
+    slotFree_.notify_all();
+  }
+  long batch = current_+1;
+  if (fed_ && batch >= numSubmitted_) {
+    std::cerr << "batch_loader: No batch submitted" << std::endl;
+    return -1;
+  }
+  Slot &slot = slot_[batch%slot_.size()];
+  if (slot.batch != batch) {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    batchReady_.wait(lock, [&]() { return slot.batch == batch; });
+    stall_ += std::chrono::duration<double>(std::chrono::steady_clock::now()-begin).count();
+  }
+  current_ = batch;
+  *data = slot.data;
+  *label = slot.label.data();
+  *numNode = slot.numNode.data();
+  *index = slot.index.data();
+  return slot.count;
+}
+
+}
+
+///
+/// @brief Opens the graph store and starts the workers; returns 0 on error.
+///
+/// index lists the graphs to draw from (numIndex of them); batches hold batchSize graphs
+/// of at most size nodes. mode 0 gives the dense adjacency (batchSize x size x size of
+/// column, or x numFeature with all columns if column < 0), mode 1 the dense Laplacian of
+/// laplModelForward from column, and mode 2 its lower triangle packed row by row. Graphs
+/// are taken in order, shuffled every epoch (shuffle != 0), or sampled with replacement
+/// proportionally to weight when it is given. numThread 0 uses all cores and numSlot < 2
+/// gives numThread+1 slots.
+///
+extern "C" void *batch_loader_open(const char *fileName, const int *index, int numIndex,
+				   int batchSize, int mode, int column, int size, int shuffle,
+				   const double *weight, int dropLast, unsigned long long seed,
+				   int numThread, int numSlot)
+{
+  BatchLoader *loader = new BatchLoader();
+  if (!loader->open(fileName) ||
+      !loader->start(index, numIndex, batchSize, mode, column, size, shuffle, weight, dropLast,
+		     seed, numThread, numSlot, false)) {
+    delete loader;
+    return 0;
+  }
+  return loader;
+}
+
+///
+/// @brief Opens the graph store and starts workers that assemble the submitted batches.
+///
+/// Options as batch_loader_open, except that batches of at most batchSize of the graphs
+/// of index are given by batch_loader_submit; returns 0 on error.
+///
+extern "C" void *batch_loader_open_fed(const char *fileName, const int *index, int numIndex,
+				       int batchSize, int mode, int column, int size,
+				       int numThread, int numSlot)
+{
+  BatchLoader *loader = new BatchLoader();
+  if (!loader->open(fileName) ||
+      !loader->start(index, numIndex, batchSize, mode, column, size, 0, 0, 0, 0, numThread,
+		     numSlot, true)) {
+    delete loader;
+    return 0;
+  }
+  return loader;
+}
+
+///
+/// @brief Queues a batch of count store indices on a fed loader; returns 0 on error.
+///
+extern "C" int batch_loader_submit(void *loader, const int *item, int count)
+{
+  return static_cast<BatchLoader*>(loader)->submit(item, count);
+}
+
+///
+/// @brief Next batch, continuing into the next epoch after numBatch() batches.
+///
+/// Returns the number of graphs in the batch and points data, label, numNode and index
+/// (store index of each graph) at the slot, which stays valid until the next call. A fed
+/// loader returns the submitted batches in order, and -1 when none is left.
+///
+extern "C" int batch_loader_next(void *loader, float **data, int **label, int **numNode,
+				 int **index)
+{
+  return static_cast<BatchLoader*>(loader)->next(data, label, numNode, index);
+}
+
+///
+/// @brief Number of batches per epoch.
+///
+extern "C" long batch_loader_batches(void *loader)
+{
+  return static_cast<BatchLoader*>(loader)->numBatch();
+}
+
+///
+/// @brief Total time (s) batch_loader_next has waited for the workers.
+///
+extern "C" double batch_loader_stall(void *loader)
+{
+  return static_cast<BatchLoader*>(loader)->stall();
+}
+
+extern "C" void batch_loader_close(void *loader)
+{
+  delete static_cast<BatchLoader*>(loader);
+}
@@ -0,0 +1,359 @@
+#!/usr/bin/env python
+# coding: utf-8
+
+# Training batches from a binary graph store, in place of the TensorDatasets of
+# densified GR_SIZE tensors and DataLoader(shuffle=True) in the notebook.
+#
+# write_graph_store() packs the _ed.csv edge lists once into a single file
+# (layout in batch_loader.cc). BatchLoader memory maps it and assembles dense
+# adjacency, dense Laplacian or packed Laplacian batches on worker threads into
+# a ring of reused buffers, so the next batches are ready while the optimizer
+# works on the current one and memory does not grow with the corpus. Shuffling
+# (one permutation per epoch) and weighted sampling use counter-based streams,
+# so the batches only depend on the seed. BatchLoader.feed() hands batches chosen
+# by the caller (e.g. by pair_sampler.HardPairSampler) to the same workers.
+# Without libbatchloader.so the same batches are assembled in numpy, one at a time:
+#
+#   g++ -O2 -shared -fPIC -pthread batch_loader.cc -o libbatchloader.so
+
+import itertools
+import os
+import shutil
+import tempfile
+from collections import deque
+import numpy as np
+
+try:
+    import ctypes
+    _lib = np.ctypeslib.load_library('libbatchloader', os.path.dirname(os.path.abspath(__file__)))
+    _lib.batch_loader_open.restype = ctypes.c_void_p
+    _lib.batch_loader_open.argtypes = (
+        [ctypes.c_char_p, np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS')] + [ctypes.c_int] * 6 +
+        [ctypes.c_void_p, ctypes.c_int, ctypes.c_ulonglong, ctypes.c_int, ctypes.c_int])
+    _lib.batch_loader_open_fed.restype = ctypes.c_void_p
+    _lib.batch_loader_open_fed.argtypes = (
+        [ctypes.c_char_p, np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS')] + [ctypes.c_int] * 7)
+    _lib.batch_loader_submit.restype = ctypes.c_int
+    _lib.batch_loader_submit.argtypes = [ctypes.c_void_p, np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS'),
+                                         ctypes.c_int]
+    _lib.batch_loader_next.restype = ctypes.c_int
+    _lib.batch_loader_next.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.POINTER(ctypes.c_float))] + \
+        [ctypes.POINTER(ctypes.POINTER(ctypes.c_int))] * 3
+    _lib.batch_loader_batches.restype = ctypes.c_long
+    _lib.batch_loader_batches.argtypes = [ctypes.c_void_p]
+    _lib.batch_loader_stall.restype = ctypes.c_double
+    _lib.batch_loader_stall.argtypes = [ctypes.c_void_p]
+    _lib.batch_loader_close.restype = None
+    _lib.batch_loader_close.argtypes = [ctypes.c_void_p]
+except OSError:
+    _lib = None
+
+MODES = {'dense': 0, 'laplacian': 1, 'packed': 2}
+_HEADER = np.dtype([('magic', 'S4'), ('version', '<u4'), ('num_graph', '<u4'),
+                    ('num_feature', '<u4'), ('num_edge', '<u8')])
+
+
+def write_graph_store(fn, fnames, labels, main_directory="graphs"):
+    # Edge lists (i, j, features) and node counts of the graphs, as read by
+    # spectral_dist.load_graph(). Node pairs go straight to the store and the
+    # features to a temporary file appended at the end, so only one graph is
+    # held in memory at a time.
+    from spectral_dist import load_graph
+    num_graph = len(fnames)
+    num_node = np.zeros(num_graph, '<i4')
+    edge_start = np.zeros(num_graph + 1, '<u8')
+    index_bytes = _HEADER.itemsize + 8 * num_graph + 8 * (num_graph + 1)
+    num_feature = None
+    with open(fn, 'wb') as f, tempfile.TemporaryFile() as values:
+        f.seek(index_bytes)
+        for g, name in enumerate(fnames):
+            edges, num_node[g] = load_graph(name, main_directory)
+            if num_feature is None:
+                num_feature = edges.shape[1] - 2
+            edges[:, :2].astype('<i4').tofile(f)
+            edges[:, 2:].astype('<f4').tofile(values)
+            edge_start[g + 1] = edge_start[g] + edges.shape[0]
+        values.seek(0)
+        shutil.copyfileobj(values, f)
+        f.seek(0)
+        np.array([(b'D2DG', 1, num_graph, num_feature or 0, edge_start[-1])], _HEADER).tofile(f)
+        num_node.tofile(f)
+        np.asarray(labels, '<i4').tofile(f)
+        edge_start.tofile(f)
+
+
+def read_graph_store(fn):
+    # Memory mapped arrays of the store
+    h = np.fromfile(fn, _HEADER, 1)[0]
+    if h['magic'] != b'D2DG' or h['version'] != 1:
+        raise ValueError("%s is not a version 1 graph store" % fn)
+    G, F, E = int(h['num_graph']), int(h['num_feature']), int(h['num_edge'])
+    m = np.memmap(fn, np.uint8, 'r')
+    o = _HEADER.itemsize
+    num_node = m[o:o + 4 * G].view('<i4')
+    label = m[o + 4 * G:o + 8 * G].view('<i4')
+    edge_start = m[o + 8 * G:o + 16 * G + 8].view('<u8')
+    o += 16 * G + 8
+    edge_node = m[o:o + 8 * E].view('<i4').reshape(E, 2)
+    edge_value = m[o + 8 * E:o + 8 * E + 4 * E * F].view('<f4').reshape(E, F)
+    return {'num_node': num_node, 'label': label, 'edge_start': edge_start,
+            'edge_node': edge_node, 'edge_value': edge_value}
+
+
+# Spectral features may follow the graphs in the store (batch_loader.cc ignores
+# them): char magic[4] = "D2DF"; uint32 numNodeFeature; uint32 numEdgeFeature;
+# uint32 numScale; float32 tp[numScale]; float32 node[sum numNode][numNodeFeature];
+# float32 edge[numEdge][numEdgeFeature]
+
+def _graph_bytes(g):
+    G, (E, F) = len(g['num_node']), g['edge_value'].shape
+    return _HEADER.itemsize + 16 * G + 8 + 8 * E + 4 * E * F
+
+
+def store_spectral_features(fn, tp, weights=None, chunk=4096, device='cpu'):
+    # Heat kernel signatures of the nodes and edge filter maps (the filter of
+    # graph_plot_from_idx, then the heat kernels) at the scales tp and eigen-weights,
+    # from one eigendecomposition per graph (spectral_dist.spectral_node_features),
+    # written after the graphs of the store in place of earlier features
+    from spectral_dist import spectral_node_features
+    g = read_graph_store(fn)
+    base, tp = _graph_bytes(g), np.asarray(tp, dtype=np.float64).ravel()
+    G, T = len(g['num_node']), len(tp)
+    with open(fn, 'r+b') as f, tempfile.TemporaryFile() as edge_part:
+        f.truncate(base)
+        f.seek(base)
+        f.write(b'D2DF')
+        np.array([T, 1 + T, T], '<u4').tofile(f)
+        tp.astype('<f4').tofile(f)
+        for c0 in range(0, G, chunk):
+            graphs = []
+            for i in range(c0, min(c0 + chunk, G)):
+                e = slice(int(g['edge_start'][i]), int(g['edge_start'][i + 1]))
+                graphs.append((np.c_[g['edge_node'][e], g['edge_value'][e]], int(g['num_node'][i])))
+            for _, hks, edge in spectral_node_features(graphs, tp, weights, device=device):
+                hks.numpy().astype('<f4').tofile(f)
+                edge.numpy().astype('<f4').tofile(edge_part)
+        edge_part.seek(0)
+        shutil.copyfileobj(edge_part, f)
+
+
+def read_store_features(fn):
+    # Per graph (node features, edge features) views of the spectral features, and tp
+    g = read_graph_store(fn)
+    base = _graph_bytes(g)
+    m = np.memmap(fn, np.uint8, 'r')
+    if bytes(m[base:base + 4]) != b'D2DF':
+        raise ValueError("%s has no spectral features" % fn)
+    num_node_feature, num_edge_feature, T = m[base + 4:base + 16].view('<u4')
+    tp = m[base + 16:base + 16 + 4 * T].view('<f4')
+    o = base + 16 + 4 * T
+    node_start = np.r_[0, np.cumsum(g['num_node'], dtype=np.int64)]
+    node = m[o:o + 4 * node_start[-1] * num_node_feature].view('<f4').reshape(-1, num_node_feature)
+    edge = m[o + node.nbytes:].view('<f4').reshape(-1, num_edge_feature)
+    edge_start = g['edge_start'].astype(np.int64)
+    features = [(node[node_start[i]:node_start[i + 1]], edge[edge_start[i]:edge_start[i + 1]])
+                for i in range(len(node_start) - 1)]
+    return features, tp
+
+
+_MASK = (1 << 64) - 1
+
+
+class _Random:
+    # splitmix64 streams of batch_loader.cc
+
+    def __init__(self, seed, stream):
+        self.state = (seed ^ (stream * 0xD1B54A32D192ED03)) & _MASK
+
+    def next(self):
+        self.state = (self.state + 0x9E3779B97F4A7C15) & _MASK
+        z = self.state
+        z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & _MASK
+        z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & _MASK
+        return z ^ (z >> 31)
+
+    def below(self, n):
+        return (self.next() * n) >> 64
+
+    def uniform(self):
+        return (self.next() >> 11) * 2.0 ** -53
+
+
+class BatchLoader:
+
+    def __init__(self, store, index, batch_size, mode='dense', channel=None, size=64, shuffle=True,
+                 weights=None, drop_last=False, seed=0, num_threads=0, num_slots=0, as_tensor=True,
+                 with_index=False):
+        # Batches of the graphs index of the store. mode 'dense' gives (B, size, size) of
+        # one channel, or (B, size, size, features) when channel is None; 'laplacian'
+        # gives the (B, size, size) Laplacian of laplModelForward and 'packed' its lower
+        # triangle, (B, size*(size+1)/2) row by row. With weights, every batch is sampled
+        # with replacement proportionally to them instead of shuffling. Iterating gives
+        # one epoch of (data, labels[, store indices]), as torch tensors with as_tensor.
+        # The arrays are only valid until the next batch: copy them (e.g. with .cuda())
+        # to keep them.
+        self.store, self.mode = store, MODES[mode]
+        self.index = np.ascontiguousarray(index, dtype=np.int32)
+        self.batch_size, self.size, self.shuffle = batch_size, size, shuffle
+        self.seed, self.as_tensor, self.with_index = seed, as_tensor, with_index
+        self.num_threads = num_threads
+        self.weights = None if weights is None else np.ascontiguousarray(weights, dtype=np.float64)
+        self._g = read_graph_store(store)
+        F = self._g['edge_value'].shape[1]
+        if channel is None:
+            self.channel = -1 if mode == 'dense' else F - 1
+        else:
+            self.channel = channel % F
+        n = len(self.index)
+        self.num_batches = n // batch_size if drop_last and n >= batch_size else -(-n // batch_size)
+        if self.mode == 2:
+            self.item_shape = (size * (size + 1) // 2,)
+        else:
+            self.item_shape = (size, size) + ((F,) if self.channel < 0 else ())
+        self._handle, self._batch = None, 0
+        if _lib is not None:
+            weight_ptr = None if self.weights is None else self.weights.ctypes.data
+            self._handle = _lib.batch_loader_open(store.encode(), self.index, n, batch_size, self.mode,
+                                                  self.channel, size, int(shuffle), weight_ptr,
+                                                  int(drop_last), seed, num_threads, num_slots)
+            if not self._handle:
+                raise ValueError("cannot assemble batches from %s" % store)
+        else:
+            if self.weights is not None:
+                self._cumulative = np.cumsum(self.weights)
+            self._permutation = {}
+
+    def __len__(self):
+        return self.num_batches
+
+    def __iter__(self):
+        for _ in range(self.num_batches):
+            data, label, num_node, index = self.next_batch()
+            out = (data, label, index) if self.with_index else (data, label)
+            if self.as_tensor:
+                import torch
+                out = tuple(torch.from_numpy(a) for a in out)
+            yield out
+
+    @property
+    def stall(self):
+        # seconds spent waiting for the workers
+        return _lib.batch_loader_stall(self._handle) if self._handle else 0.0
+
+    def next_batch(self):
+        # (data, labels, node counts, store indices) of the next batch
+        if self._handle:
+            return self._next(self._handle)
+        items = self._items(self._batch)
+        self._batch += 1
+        g = self._g
+        return (np.stack([self._item(i) for i in items]).reshape((len(items),) + self.item_shape),
+                g['label'][items].astype(np.int32), g['num_node'][items].astype(np.int32), items)
+
+    def assemble(self, items):
+        # (data, labels) of the given store indices, e.g. graphs chosen by a sampler,
+        # in new arrays
+        items = np.asarray(items)
+        g = self._g
+        data = np.stack([self._item(i) for i in items]).reshape((len(items),) + self.item_shape)
+        label = g['label'][items].astype(np.int32)
+        if self.as_tensor:
+            import torch
+            return torch.from_numpy(data), torch.from_numpy(label)
+        return data, label
+
+    def feed(self, batches, items=None, depth=2):
+        # Assembles caller-chosen batches on the worker threads and yields (batch, data,
+        # labels) for every batch of the iterable batches, where the store indices of a
+        # batch are items(batch) (the batch itself by default; at most batch_size of the
+        # graphs of index). The workers run depth batches ahead, so batches is consumed
+        # that much early: a HardPairSampler then draws each batch from its estimates of
+        # depth updates before, which keeps the importance weights (taken from the q the
+        # pairs were drawn from) unbiased. data and labels are valid until the next batch.
+        # Without libbatchloader.so the batches are assembled by assemble() as they come.
+        items = items or (lambda b: b)
+        if _lib is None:
+            for b in batches:
+                yield (b,) + tuple(self.assemble(items(b)))
+            return
+        handle = _lib.batch_loader_open_fed(self.store.encode(), self.index, len(self.index), self.batch_size,
+                                            self.mode, self.channel, self.size, self.num_threads, depth + 2)
+        if not handle:
+            raise ValueError("cannot assemble batches from %s" % self.store)
+        try:
+            it, pending = iter(batches), deque()
+            for b in itertools.islice(it, depth + 1):
+                self._submit(handle, items(b))
+                pending.append(b)
+            while pending:
+                data, label, _, _ = self._next(handle)
+                if self.as_tensor:
+                    import torch
+                    data, label = torch.from_numpy(data), torch.from_numpy(label)
+                yield pending.popleft(), data, label
+                # drawn after the update of the batch just used
+                for b in itertools.islice(it, 1):
+                    self._submit(handle, items(b))
+                    pending.append(b)
+        finally:
+            _lib.batch_loader_close(handle)
+
+    def close(self):
+        if self._handle:
+            _lib.batch_loader_close(self._handle)
+            self._handle = None
+
+    def __del__(self):
+        self.close()
+
+    def _submit(self, handle, items):
+        items = np.ascontiguousarray(items, dtype=np.int32)
+        if not _lib.batch_loader_submit(handle, items, len(items)):
+            raise ValueError("cannot submit a batch of %d graphs" % len(items))
+
+    def _next(self, handle):
+        data, label = ctypes.POINTER(ctypes.c_float)(), ctypes.POINTER(ctypes.c_int)()
+        num_node, index = ctypes.POINTER(ctypes.c_int)(), ctypes.POINTER(ctypes.c_int)()
+        count = _lib.batch_loader_next(handle, ctypes.byref(data), ctypes.byref(label),
+                                       ctypes.byref(num_node), ctypes.byref(index))
+        return (np.ctypeslib.as_array(data, (count,) + self.item_shape),
+                np.ctypeslib.as_array(label, (count,)), np.ctypeslib.as_array(num_node, (count,)),
+                np.ctypeslib.as_array(index, (count,)))
+
+    def _items(self, batch):
+        epoch, begin = divmod(batch, self.num_batches)
+        begin *= self.batch_size
+        count = min(self.batch_size, len(self.index) - begin)
+        if self.weights is not None:
+            r = _Random(self.seed, 2 * batch + 1)
+            u = np.array([r.uniform() for _ in range(count)]) * self._cumulative[-1]
+            k = np.minimum(np.searchsorted(self._cumulative, u, side='right'), len(self.index) - 1)
+            return self.index[k]
+        if not self.shuffle:
+            return self.index[begin:begin + count]
+        if epoch not in self._permutation:
+            order, r = self.index.copy(), _Random(self.seed, 2 * epoch)
+            for i in range(len(order) - 1, 0, -1):
+                j = r.below(i + 1)
+                order[i], order[j] = order[j], order[i]
+            self._permutation = {epoch: order}
+        return self._permutation[epoch][begin:begin + count]
+
+    def _item(self, i):
+        g, n = self._g, self.size
+        e = slice(int(g['edge_start'][i]), int(g['edge_start'][i + 1]))
+        k = g['edge_node'][e, 0].astype(np.int64) * n + g['edge_node'][e, 1]
+        if self.mode == 0:
+            F = g['edge_value'].shape[1]
+            if self.channel >= 0:
+                out = np.zeros(n * n, np.float32)
+                np.add.at(out, k, g['edge_value'][e, self.channel])
+            else:
+                out = np.zeros((n * n, F), np.float32)
+                np.add.at(out, k, g['edge_value'][e])
+            return out
+        A = np.zeros(n * n, np.float32)
+        np.add.at(A, k, g['edge_value'][e, self.channel])
+        A = np.sign(A).reshape(n, n)
+        L = A - np.diag((0.5 * (np.abs(A) + np.abs(A.T))).sum(-1))
+        return L[np.tril_indices(n)] if self.mode == 2 else L
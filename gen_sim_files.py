@@ -66,11 +66,17 @@ RemovalOutsideRadius 	     # Remove cells outside a specified radius
 # --- parameters
 60.0			     # R_threshold, radius outside which cells are removed
 """
+# Sweep coordinates of each model as numeric metadata (k_force, Lwall_threshold,
+# RandDivFreq, RandDivLocFreq; disabled random divisions (-1) as 0), read by
+# spectral_dist.load_sim_params()
+param_file = open("sim_params.txt",'w')
 for ii,k_force in enumerate([.1,.3,1.0,3.0]):
     for jj,LWt in enumerate([.1,.3,.6]):
         for kk,randFreq in enumerate([-1.0,.00001,.00003,.0001]):
             for ll,randDivFreq in enumerate([-1.0,.01,.03,.1,.5,1.0]):
                 with open("modelfiles/s%d_s%d_s%d_s%d.model"%(ii,jj,kk,ll),'w') as f:
                     f.write(mod_string % (k_force,LWt,randFreq,randDivFreq))
+                param_file.write("s%d_s%d_s%d_s%d %r %r %r %r\n" % (ii,jj,kk,ll,k_force,LWt,max(randFreq,0.0),max(randDivFreq,0.0)))
                 for mm in range(1,2):
                     print(ii,jj,kk,ll,mm)
+param_file.close()
@@ -12,43 +12,89 @@ import scipy.sparse as spr
 
 from skimage.segmentation import watershed
 
-from sklearn.neighbors import radius_neighbors_graph
+import native_watershed
+
+# One pass over the label image instead of one dilated full-size mask per component.
+# For labels >= first_label it accumulates pixel counts, centroids (x,y as cv2.findNonZero)
+# and second central moments, and for each pair of labels the number of pixels whose
+# footprint (element anchored at its centre, as cv2.dilate) sees both labels, i.e. the
+# overlap of the two dilated masks. Only pixels seeing two labels are expanded into pairs,
+# and pairs are aggregated per block of rows on int64 keys a*n+b (a<b).
+def label_graph(labels, element, first_label=2, block_rows=64):
+    h, w = labels.shape
+    lab = np.where(labels >= first_label, labels, 0).astype(np.int64)
+    n = int(lab.max()) + 1
+
+    flat = lab.ravel()
+    y, x = np.divmod(np.arange(flat.size), w)
+    count = np.bincount(flat, minlength=n).astype(np.float64)
+    sums = [np.bincount(flat, weights=f, minlength=n) for f in (x, y, x*x, x*y, y*y)]
+    del y, x
+    safe = np.maximum(count, 1)
+    cx, cy = sums[0]/safe, sums[1]/safe
+    centroid = np.stack([cx, cy], 1)
+    moments = np.stack([sums[2]/safe - cx*cx, sums[3]/safe - cx*cy, sums[4]/safe - cy*cy], 1)
+
+    dy, dx = np.nonzero(element)
+    dy = dy - element.shape[0]//2
+    dx = dx - element.shape[1]//2
+    pt, pl = max(0, -dy.min()), max(0, -dx.min())
+    padded = np.pad(lab, ((pt, max(0, dy.max())), (pl, max(0, dx.max()))))
+
+    keys, counts = [], []
+    for r0 in range(0, h, block_rows):
+        r1 = min(h, r0 + block_rows)
+        seen = np.stack([padded[pt+r0+a:pt+r1+a, pl+b:pl+b+w].ravel() for a, b in zip(dy, dx)], 1)
+        high = seen.max(1)
+        low = np.where(seen > 0, seen, n).min(1)
+        seen = np.sort(seen[low < high], axis=1)
+        if not seen.shape[0]:
+            continue
+        # distinct labels to the front, duplicates and background to the back
+        seen[:, 1:][seen[:, 1:] == seen[:, :-1]] = 0
+        seen[seen == 0] = n
+        seen.sort(axis=1)
+        numdistinct = (seen < n).sum(1)
+        pairs = [seen[numdistinct > j, i]*n + seen[numdistinct > j, j]
+                 for j in range(1, numdistinct.max()) for i in range(j)]
+        k, c = np.unique(np.concatenate(pairs), return_counts=True)
+        keys.append(k)
+        counts.append(c)
+
+    if keys:
+        k, inverse = np.unique(np.concatenate(keys), return_inverse=True)
+        c = np.bincount(inverse, weights=np.concatenate(counts))
+    else:
+        k, c = np.zeros(0, np.int64), np.zeros(0)
+    contacts = spr.coo_matrix((c, (k//n, k%n)), shape=(n, n))
+    return count, centroid, moments, contacts
 
 nickname=sys.argv[1]
 
 test_im = cv2.imread("output_imgs/%s.tif" % nickname)
 
-test_im *= np.pad(cv2.getStructuringElement(cv2.MORPH_ELLIPSE,(512+256,512+256)),((128,128),(128,128))).reshape(1024,1024,1)
-
-comps = watershed(test_im)[:,:,0]
+if native_watershed.available and test_im.dtype == np.uint8:
+    # masks and floods channel 0 directly, same labels as skimage (watershed.cc)
+    comps = native_watershed.watershed(test_im,(512+256,512+256),(128,128))
+else:
+    test_im *= np.pad(cv2.getStructuringElement(cv2.MORPH_ELLIPSE,(512+256,512+256)),((128,128),(128,128))).reshape(1024,1024,1)
+    comps = watershed(test_im)[:,:,0]
 ncomps = np.max(comps)
 
 element = cv2.getStructuringElement(cv2.MORPH_ELLIPSE,(6,6))
 
-flat_ims = [(comps==i).astype('int') for i in range(ncomps+1)]
-
-dilate_ims = [0,0]+[spr.csr_matrix(np.sign(cv2.dilate(flat_ims[i].astype('float'),element))) for i in range(2,ncomps+1)]
+count, centroid, moments, contacts = label_graph(comps, element)
 
-c_coords = {}
-for i in range(2,ncomps+1):
-    vv=cv2.findNonZero(flat_ims[i])[:,0,:]
-    centroid = np.mean(np.stack(vv),0)
-    c_coords[i] = centroid
+c_coords = {i:centroid[i] for i in range(2,ncomps+1) if count[i] > 0}
 
 sc = np.stack(list(c_coords.values()))
 
-bigrad_graph = radius_neighbors_graph(sc,100.0)
-
-zz = np.nonzero(np.triu(bigrad_graph.todense(),k=1))
-
-for ii in range(zz[0].shape[0]):
-    im1 = dilate_ims[zz[0][ii]+2]
-    im2 = dilate_ims[zz[1][ii]+2]
-    rez = im1.multiply(im2).sum()
-    bigrad_graph[zz[0][ii],zz[1][ii]] *= rez
-    bigrad_graph[zz[1][ii],zz[0][ii]] *= rez
+# contacts between components whose centroids are at most 100 pixels apart
+near = np.linalg.norm(centroid[contacts.row] - centroid[contacts.col],axis=-1) <= 100.0
 
-gpr = nx.from_numpy_array(np.pad(np.abs(bigrad_graph.todense()),((2,0),(2,0))))
+gpr = nx.Graph()
+gpr.add_nodes_from(range(ncomps+1))
+gpr.add_weighted_edges_from(zip(contacts.row[near],contacts.col[near],contacts.data[near]))
 
 from scipy.spatial.distance import pdist,squareform
 
@@ -0,0 +1,88 @@
+//
+// Filename     : knn_eval.cc
+// Description  : Distance-weighted kNN accuracy for a range of k from one neighbour sort
+// Revision     : $Id:$
+//
+// Compile as a shared library next to spectral_dist.py, which then uses it in
+// knn_accuracy_curve():
+//
+//   g++ -O2 -shared -fPIC -pthread knn_eval.cc -o libknneval.so
+//
+// The classifier is sklearn's KNeighborsClassifier(k, metric='precomputed',
+// weights='distance'): neighbours vote with weight 1/distance, or, if any of the k
+// neighbours is at distance 0, only those vote (with weight 1), and ties between classes
+// go to the smallest class. The kMax nearest references of each query are selected and
+// sorted once (by distance, then index), after which adding the neighbours one by one
+// gives the class scores, and thus the prediction, for every k in a single sweep.
+//
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+///
+/// @brief Accuracy of the distance-weighted kNN classifier for k = kMin..kMax.
+///
+/// dist is the numQuery x numRef distance matrix (row major), labels are class indices in
+/// 0..numClass-1. The accuracies are written to accuracy (kMax-kMin+1 values), and the
+/// largest k with the best accuracy is returned. numThread 0 uses all cores.
+///
+extern "C" int knn_accuracy_curve(const double *dist, int numQuery, int numRef,
+				  const int *refLabel, const int *queryLabel, int numClass,
+				  int kMin, int kMax, int numThread, double *accuracy)
+{
+  kMax = std::min(kMax, numRef);
+  if (kMin < 1 || kMax < kMin)
+    return 0;
+  if (numThread <= 0)
+    numThread = std::max(1u, std::thread::hardware_concurrency());
+  numThread = std::max(1, std::min(numThread, numQuery/16));
+
+  std::vector< std::vector<long> > threadCorrect(numThread, std::vector<long>(kMax+1, 0));
+  std::atomic<int> next(0);
+  std::vector<std::thread> thread;
+  for (int t=0; t<numThread; ++t)
+    thread.push_back(std::thread([&, t]() {
+	  std::vector<int> order(numRef);
+	  std::vector<double> zeroScore(numClass), inverseScore(numClass);
+	  std::vector<long> &correct = threadCorrect[t];
+	  for (int q=next++; q<numQuery; q=next++) {
+	    const double *d = dist + size_t(q)*numRef;
+	    for (int r=0; r<numRef; ++r)
+	      order[r] = r;
+	    std::partial_sort(order.begin(), order.begin()+kMax, order.end(), [d](int a, int b) {
+		return d[a] < d[b] || (d[a] == d[b] && a < b);
+	      });
+	    std::fill(zeroScore.begin(), zeroScore.end(), 0.0);
+	    std::fill(inverseScore.begin(), inverseScore.end(), 0.0);
+	    int numZero = 0;
+	    for (int k=1; k<=kMax; ++k) {
+	      int r = order[k-1];
+	      if (d[r] == 0.0) {
+		zeroScore[refLabel[r]] += 1.0;
+		++numZero;
+	      }
+	      else
+		inverseScore[refLabel[r]] += 1.0/d[r];
+	      if (k < kMin)
+		continue;
+	      const std::vector<double> &score = numZero ? zeroScore : inverseScore;
+	      int predicted = int(std::max_element(score.begin(), score.end())-score.begin());
+	      correct[k] += predicted == queryLabel[q];
+	    }
+	  }
+	}));
+  for (size_t t=0; t<thread.size(); ++t)
+    thread[t].join();
+
+  int best = kMin;
+  for (int k=kMin; k<=kMax; ++k) {
+    long sum = 0;
+    for (int t=0; t<numThread; ++t)
+      sum += threadCorrect[t][k];
+    accuracy[k-kMin] = numQuery ? double(sum)/numQuery : 0.0;
+    if (accuracy[k-kMin] >= accuracy[best-kMin])
+      best = k;
+  }
+  return best;
+}
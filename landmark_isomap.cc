@@ -0,0 +1,69 @@
+//
+// Filename     : landmark_isomap.cc
+// Description  : Geodesic distances from landmarks on a kNN graph, for landmark Isomap
+// Revision     : $Id:$
+//
+// Compile as a shared library next to landmark_isomap.py, which then uses it instead of
+// scipy.sparse.csgraph.dijkstra:
+//
+//   g++ -O2 -shared -fPIC -pthread landmark_isomap.cc -o liblandmarkisomap.so
+//
+// One Dijkstra search per landmark on the (symmetric) neighbourhood graph, with the
+// landmarks shared out to a pool of threads. The graph is in CSR form (rowStart,
+// column, weight) and each search costs O(E log N), i.e. O(N k log N) for a kNN graph.
+//
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+///
+/// @brief Shortest path distances from each landmark to all nodes.
+///
+/// distance is numLandmark x numNode (row major); unreachable nodes get infinity.
+/// numThread 0 uses all cores.
+///
+extern "C" void landmark_dijkstra(int numNode, const int *rowStart, const int *column,
+				  const double *weight, int numLandmark, const int *landmark,
+				  int numThread, double *distance)
+{
+  if (numThread <= 0)
+    numThread = std::max(1u, std::thread::hardware_concurrency());
+  numThread = std::max(1, std::min(numThread, numLandmark));
+
+  typedef std::pair<double, int> Entry;
+  std::atomic<int> next(0);
+  std::vector<std::thread> thread;
+  for (int t=0; t<numThread; ++t)
+    thread.push_back(std::thread([&]() {
+	  std::vector<Entry> heap;
+	  for (int l=next++; l<numLandmark; l=next++) {
+	    double *d = distance + size_t(l)*numNode;
+	    std::fill(d, d+numNode, std::numeric_limits<double>::infinity());
+	    d[landmark[l]] = 0.0;
+	    heap.assign(1, Entry(0.0, landmark[l]));
+	    while (!heap.empty()) {
+	      std::pop_heap(heap.begin(), heap.end(), std::greater<Entry>());
+	      Entry e = heap.back();
+	      heap.pop_back();
+	      // Entries superseded by a shorter path are skipped
+	      if (e.first > d[e.second])
+		continue;
+	      for (int k=rowStart[e.second]; k<rowStart[e.second+1]; ++k) {
+		double candidate = e.first + weight[k];
+		if (candidate < d[column[k]]) {
+		  d[column[k]] = candidate;
+		  heap.push_back(Entry(candidate, column[k]));
+		  std::push_heap(heap.begin(), heap.end(), std::greater<Entry>());
+		}
+	      }
+	    }
+	  }
+	}));
+  for (size_t t=0; t<thread.size(); ++t)
+    thread[t].join();
+}
@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+# coding: utf-8
+
+# Landmark Isomap over the spectral graph distance, in place of sklearn's
+# Isomap(n_neighbors, metric='precomputed') in the notebook figures.
+#
+# The kNN graph is built either from a precomputed distance matrix or from the
+# spectra directly with spectral_dist.knn(), so the N x N matrix is not needed.
+# Geodesics are only computed from n_landmarks landmarks (one Dijkstra search
+# each, on all cores with landmark_isomap.cc when liblandmarkisomap.so has been
+# built next to this file, scipy otherwise), and points are placed by landmark
+# MDS (de Silva and Tenenbaum): cost O(N L) instead of all-pairs shortest paths
+# and an N x N eigendecomposition. New points (validation or simulated graphs)
+# are placed by transform() from their nearest training points, as Isomap does.
+# With n_landmarks >= N all points are landmarks and the embedding is Isomap's.
+#
+#   g++ -O2 -shared -fPIC -pthread landmark_isomap.cc -o liblandmarkisomap.so
+
+import os
+import warnings
+import numpy as np
+import scipy.sparse as spr
+from scipy.sparse.csgraph import connected_components, dijkstra
+
+try:
+    import ctypes
+    _lib = np.ctypeslib.load_library('liblandmarkisomap', os.path.dirname(os.path.abspath(__file__)))
+    _lib.landmark_dijkstra.restype = None
+    _lib.landmark_dijkstra.argtypes = (
+        [ctypes.c_int] + [np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS')] * 2 +
+        [np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS'), ctypes.c_int,
+         np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS'), ctypes.c_int,
+         np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')])
+except OSError:
+    _lib = None
+
+
+def landmark_geodesics(graph, landmarks, num_threads=0):
+    # (L, N) shortest path distances from the landmarks on a symmetric CSR graph
+    graph = spr.csr_matrix(graph)
+    landmarks = np.ascontiguousarray(landmarks, dtype=np.int32)
+    if _lib is None:
+        return dijkstra(graph, directed=True, indices=landmarks)
+    out = np.empty((len(landmarks), graph.shape[0]))
+    _lib.landmark_dijkstra(graph.shape[0], graph.indptr.astype(np.int32), graph.indices.astype(np.int32),
+                           graph.data.astype(np.float64), len(landmarks), landmarks, num_threads, out)
+    return out
+
+
+def _knn_from_matrix(dist, k, exclude_self):
+    dist = np.asarray(dist, dtype=np.float64)
+    if exclude_self:
+        dist = dist.copy()
+        np.fill_diagonal(dist, np.inf)
+    index = np.argpartition(dist, k - 1, axis=1)[:, :k]
+    return index, np.take_along_axis(dist, index, 1)
+
+
+def _knn_graph(index, dist, n):
+    # undirected, as shortest_path(directed=False): the shorter of the two directions
+    rows = np.repeat(np.arange(n), index.shape[1])
+    i, j, d = np.r_[rows, index.ravel()], np.r_[index.ravel(), rows], np.r_[dist.ravel(), dist.ravel()]
+    key = i.astype(np.int64) * n + j
+    order = np.lexsort((d, key))
+    first = order[np.r_[True, key[order][1:] != key[order][:-1]]]
+    # zero distances would be dropped as missing edges by the sparse matrix
+    d = np.maximum(d[first], np.finfo(float).tiny)
+    return spr.csr_matrix((d, (i[first], j[first])), shape=(n, n))
+
+
+def _connect(graph, nearest_outside):
+    # Joins the components of the graph by the closest pair between each smaller
+    # component and the rest, until it is connected
+    graph = graph.tolil()
+    while True:
+        num, comp = connected_components(graph, directed=False)
+        if num == 1:
+            return graph.tocsr()
+        warnings.warn("kNN graph has %d components, joining them by their closest pairs" % num)
+        largest = np.bincount(comp).argmax()
+        for c in range(num):
+            if c != largest:
+                i, j, d = nearest_outside(np.flatnonzero(comp == c), np.flatnonzero(comp != c))
+                graph[i, j] = graph[j, i] = max(d, np.finfo(float).tiny)
+
+
+class LandmarkIsomap:
+
+    def __init__(self, n_neighbors=10, n_components=2, n_landmarks=300, seed=0, num_threads=0):
+        self.n_neighbors = n_neighbors
+        self.n_components = n_components
+        self.n_landmarks = n_landmarks
+        self.seed = seed
+        self.num_threads = num_threads
+
+    def fit_transform(self, dist):
+        # dist: (N, N) precomputed distances between the training graphs
+        dist = np.asarray(dist, dtype=np.float64)
+
+        def nearest_outside(a, b):
+            sub = dist[np.ix_(a, b)]
+            i, j = np.unravel_index(np.argmin(sub), sub.shape)
+            return a[i], b[j], sub[i, j]
+        index, d = _knn_from_matrix(dist, self.n_neighbors, exclude_self=True)
+        return self._fit(index, d, nearest_outside)
+
+    def transform(self, dist):
+        # dist: (M, N) distances from new graphs to the training graphs
+        index, d = _knn_from_matrix(dist, self.n_neighbors, exclude_self=False)
+        return self._place(index, d)
+
+    def fit_spectra(self, spectra, tp, weights=None):
+        # kNN graph from the spectra with spectral_dist.knn(), without the N x N matrix
+        import spectral_dist
+        self._spectra, self._tp, self._weights = spectra, tp, weights
+        index, d, _ = spectral_dist.knn(spectra, spectra, tp, self.n_neighbors + 1, weights)
+        # drop each graph itself (or the farthest neighbour if duplicates hid it)
+        n = len(spectra)
+        is_self = index == np.arange(n)[:, None]
+        drop = np.where(is_self.any(1), is_self.argmax(1), index.shape[1] - 1)
+        keep = np.ones(index.shape, bool)
+        keep[np.arange(n), drop] = False
+        index, d = index[keep].reshape(n, -1), d[keep].reshape(n, -1)
+
+        def nearest_outside(a, b):
+            i, dd, _ = spectral_dist.knn([spectra[k] for k in a], [spectra[k] for k in b], tp, 1, weights)
+            r = int(np.argmin(dd[:, 0]))
+            return a[r], b[i[r, 0]], dd[r, 0]
+        return self._fit(index, d, nearest_outside)
+
+    def transform_spectra(self, spectra):
+        import spectral_dist
+        index, d, _ = spectral_dist.knn(spectra, self._spectra, self._tp, self.n_neighbors, self._weights)
+        return self._place(index, d)
+
+    def _fit(self, index, d, nearest_outside):
+        n = index.shape[0]
+        graph = _connect(_knn_graph(index, d, n), nearest_outside)
+        rng = np.random.default_rng(self.seed)
+        self.landmarks_ = np.arange(n) if self.n_landmarks >= n else \
+            np.sort(rng.choice(n, self.n_landmarks, replace=False))
+        # (N, L) geodesics of all training graphs to the landmarks
+        self.geodesics_ = landmark_geodesics(graph, self.landmarks_, self.num_threads).T
+
+        # classical MDS of the landmarks
+        delta = self.geodesics_[self.landmarks_] ** 2
+        delta = 0.5 * (delta + delta.T)
+        self.delta_mean_ = delta.mean(0)
+        B = -0.5 * (delta - self.delta_mean_[None, :] - self.delta_mean_[:, None] + delta.mean())
+        lam, vec = np.linalg.eigh(B)
+        order = np.argsort(lam)[::-1][:self.n_components]
+        lam, vec = np.maximum(lam[order], np.finfo(float).tiny), vec[:, order]
+        # distance-based triangulation: y = -1/2 pinv(L) (delta_x - delta_mean)
+        self.pinv_ = (vec / np.sqrt(lam)).T
+        self.embedding_ = self._triangulate(self.geodesics_)
+        return self.embedding_
+
+    def _place(self, index, d):
+        # geodesic to each landmark through the nearest training graphs
+        g = np.full((index.shape[0], len(self.landmarks_)), np.inf)
+        for k in range(index.shape[1]):
+            np.minimum(g, d[:, k:k + 1] + self.geodesics_[index[:, k]], out=g)
+        return self._triangulate(g)
+
+    def _triangulate(self, geodesics):
+        return -0.5 * (geodesics ** 2 - self.delta_mean_) @ self.pinv_.T
@@ -0,0 +1,126 @@
+#!/usr/bin/env python
+# coding: utf-8
+
+# Hard-pair mining for the margin loss of the training loops.
+#
+# The loss of a batch is the mean over its B^2 pairs of relu(d - lower_margin)^2
+# for same-label pairs and relu(upper_margin - d)^2 for cross-label pairs, and
+# most pairs already satisfy their margin. HardPairSampler keeps an estimate of
+# the distance of every training pair: initially a precomputed matrix (e.g.
+# expt1_dmat), then the distances of each batch as it is trained on, and every
+# `refresh` batches all pairs again from the last spectrum seen of each graph at
+# the current tp and weights. Batches are drawn as pairs, half of the mass in
+# proportion to the estimated loss of the same-label pairs and half to that of
+# the cross-label pairs, mixed with a uniform share so that no pair has zero
+# probability. With the importance weights 1/(N^2 q P) the weighted loss of the
+# P drawn pairs is an unbiased estimate of the mean loss over all N^2 training
+# pairs, and only the graphs of the drawn pairs are eigensolved.
+
+from collections import namedtuple
+import numpy as np
+
+# graphs: training positions to eigensolve; a, b: the drawn pairs as rows of
+# graphs; same: same-label pairs; weights: importance weights of the pairs
+PairBatch = namedtuple('PairBatch', ['graphs', 'a', 'b', 'same', 'weights'])
+
+
+class HardPairSampler:
+
+    def __init__(self, labels, initial_dist, lower_margin, upper_margin, pairs_per_batch=64,
+                 uniform=0.2, refresh=50, num_batches=None, seed=0):
+        # labels and initial_dist (N x N) of the N training graphs; num_batches per
+        # epoch defaults to that of a 256-graph loader over them
+        self.labels = np.asarray(labels)
+        self.n = len(self.labels)
+        self.lower_margin, self.upper_margin = lower_margin, upper_margin
+        self.pairs_per_batch, self.uniform, self.refresh = pairs_per_batch, uniform, refresh
+        self.num_batches = num_batches or -(-self.n // 256)
+        self.i, self.j = np.triu_indices(self.n, 1)
+        self.same = self.labels[self.i] == self.labels[self.j]
+        self.dist = np.asarray(initial_dist, dtype=np.float64)[self.i, self.j]
+        self.spectra = [None] * self.n
+        self.rng = np.random.default_rng(seed)
+        self.step = 0
+        self._cumulative = None
+
+    def __len__(self):
+        return self.num_batches
+
+    def __iter__(self):
+        for _ in range(self.num_batches):
+            yield self.sample()
+
+    def pair_loss(self, d):
+        return np.where(self.same, np.maximum(d - self.lower_margin, 0),
+                        np.maximum(self.upper_margin - d, 0)) ** 2
+
+    def probabilities(self):
+        # q over the pairs i < j
+        est = self.pair_loss(self.dist)
+        q = np.full(len(est), self.uniform / len(est))
+        groups = [g for g in (self.same, ~self.same) if est[g].sum() > 0]
+        for g in groups:
+            q[g] += (1 - self.uniform) / len(groups) * est[g] / est[g].sum()
+        return q / q.sum() if groups else np.full(len(est), 1.0 / len(est))
+
+    def sample(self):
+        # q is kept until the estimates change
+        if self._cumulative is None:
+            self._q = self.probabilities()
+            self._cumulative = np.cumsum(self._q)
+        q = self._q
+        k = np.minimum(np.searchsorted(self._cumulative, self.rng.random(self.pairs_per_batch) * self._cumulative[-1],
+                                       side='right'), len(q) - 1)
+        graphs, rows = np.unique(np.r_[self.i[k], self.j[k]], return_inverse=True)
+        P = self.pairs_per_batch
+        # the loss over ordered pairs counts every pair i < j twice (the diagonal is 0)
+        weights = 2.0 / (self.n ** 2 * q[k] * P)
+        return PairBatch(graphs, rows[:P], rows[P:], self.same[k], weights)
+
+    def loss(self, dist_mat_batch, batch):
+        # weighted margin loss of the drawn pairs, from the distances between batch.graphs
+        import torch
+        relu = torch.nn.functional.relu
+        d = dist_mat_batch[torch.as_tensor(batch.a), torch.as_tensor(batch.b)]
+        same = d.new_tensor(batch.same.astype(np.float64))
+        viol = same * relu(d - self.lower_margin) + (1 - same) * relu(self.upper_margin - d)
+        return (d.new_tensor(batch.weights) * viol ** 2).sum()
+
+    def update(self, batch, dist_mat_batch, spectra=None, tp=None, weights=None):
+        # Distances (and spectra) of the batch graphs from the training step; with tp
+        # and weights, all pairs are recomputed every refresh steps
+        g = batch.graphs
+        d = np.asarray(dist_mat_batch, dtype=np.float64)
+        ii, jj = np.triu_indices(len(g), 1)
+        self.dist[self._pair_index(g[ii], g[jj])] = d[ii, jj]
+        self._cumulative = None
+        if spectra is not None:
+            for r, s in zip(g, np.asarray(spectra, dtype=np.float64)):
+                self.spectra[r] = s
+        self.step += 1
+        if tp is not None and self.step % self.refresh == 0:
+            self.refresh_all(tp, weights)
+
+    def refresh_all(self, tp, weights=None):
+        # Pair distances from the cached spectra (graphs not seen yet keep their estimates)
+        from spectral_dist import _as_extended, _scale_dists
+        seen = np.array([s is not None for s in self.spectra])
+        idx = np.flatnonzero(seen)
+        if len(idx) < 2:
+            return
+        E = _as_extended([self.spectra[r] for r in idx], max(len(self.spectra[r]) for r in idx))
+        w = np.ones(E.shape[1]) if weights is None else \
+            np.asarray(weights, dtype=np.float64).ravel()[:E.shape[1]]
+        # running max over the scales, one N x N matrix at a time
+        tp = np.asarray(tp, dtype=np.float64).ravel()
+        D = _scale_dists(E, E, tp[0], w)
+        for t in tp[1:]:
+            np.maximum(D, _scale_dists(E, E, t, w), out=D)
+        ii, jj = np.triu_indices(len(idx), 1)
+        self.dist[self._pair_index(idx[ii], idx[jj])] = D[ii, jj]
+        self._cumulative = None
+
+    def _pair_index(self, i, j):
+        # position of the pair (i < j) in the row-major upper triangle
+        i, j = np.minimum(i, j).astype(np.int64), np.maximum(i, j).astype(np.int64)
+        return i * self.n - i * (i + 1) // 2 + j - i - 1
@@ -0,0 +1,677 @@
+#!/usr/bin/env python
+# coding: utf-8
+
+# Spectral engine for the graph distance used in DAGM_expts_and_figs.ipynb.
+#
+# Graphs are kept ragged, with their true node counts, instead of being padded
+# into GR_SIZE. Padding nodes are isolated, so each of them only adds an exact
+# zero eigenvalue to the Laplacian. The distance therefore compares spectra of
+# different length by zero-extension: a spectrum of n <= N eigenvalues (all <= 0,
+# sorted ascending) is extended with N-n zeros at the top, i.e. heat-trace terms
+# exp(t*0) = 1. This reproduces the padded distances without paying for padding.
+
+import os
+import numpy as np
+import torch
+
+
+def load_graph(fn, main_directory="graphs"):
+    edges = np.loadtxt(main_directory + "/" + fn + "_ed.csv").astype('float').reshape(-1, 5)
+    vfn = main_directory + "/" + fn + "_ve.csv"
+    if os.path.exists(vfn):
+        n = np.loadtxt(vfn).reshape(-1, 2).shape[0]
+    else:
+        n = int(edges[:, :2].max()) + 1 if edges.shape[0] else 0
+    return edges, n
+
+
+def laplacian(edges, n, col=-1, dtype=torch.float64):
+    # Same construction as laplModelForward: A = sign(w), L = A - diag(sum(sym|A|)),
+    # where duplicate edges add up (as in to_dense()) before the sign is taken
+    A = torch.zeros((n, n), dtype=dtype)
+    if edges.shape[0]:
+        index = torch.as_tensor(edges[:, :2].astype('int64').T)
+        A.index_put_((index[0], index[1]), torch.as_tensor(edges[:, col], dtype=dtype), accumulate=True)
+    A = torch.sign(A)
+    dd = torch.abs(A)
+    dd = .5 * (dd + dd.T)
+    return A - torch.diag(dd.sum(-1))
+
+
+def size_buckets(sizes, bucket_width=1):
+    # bucket_width=1 gives exact-size buckets (no padding at all); wider buckets
+    # trade a few padding nodes for larger batched eigensolves.
+    sizes = np.asarray(sizes)
+    keys = (sizes + bucket_width - 1) // bucket_width * bucket_width
+    return {int(k): np.nonzero(keys == k)[0] for k in np.unique(keys)}
+
+
+def ragged_spectra(lapls, bucket_width=1, device='cpu'):
+    # lapls: list of (n_i, n_i) Laplacians. Returns a list of ascending spectra
+    # of length n_i, computed with one batched eigensolve per size bucket.
+    sizes = np.array([L.shape[0] for L in lapls])
+    out = [None] * len(lapls)
+    for m, idxs in size_buckets(sizes, bucket_width).items():
+        batch = torch.zeros((len(idxs), m, m), dtype=lapls[idxs[0]].dtype)
+        for b, i in enumerate(idxs):
+            batch[b, :sizes[i], :sizes[i]] = lapls[i]
+        eigs = torch.linalg.eigvalsh(batch.to(device)).cpu()
+        for b, i in enumerate(idxs):
+            # padding nodes only add exact zeros at the top of the spectrum
+            out[i] = eigs[b, :sizes[i]]
+    return out
+
+
+def model_laplacians(forward, graphs, device='cpu', max_batch=512):
+    # Laplacians of a learned laplModelForward (sparse (B, m, m, features) edge
+    # tensors to dense (B, m, m)) for graphs (edges, n) at their true size, one
+    # call per size. The models give padding nodes no edges, so these are the
+    # padded Laplacians without the padding.
+    sizes = np.array([n for _, n in graphs])
+    num_feature = graphs[0][0].shape[1] - 2
+    out = [None] * len(graphs)
+    for m, idxs in size_buckets(sizes).items():
+        for c0 in range(0, len(idxs), max_batch):
+            chunk = idxs[c0:c0 + max_batch]
+            if m == 0:
+                for i in chunk:
+                    out[i] = torch.zeros((0, 0), dtype=torch.float64)
+                continue
+            index = np.concatenate([np.c_[np.full(len(graphs[i][0]), b), graphs[i][0][:, :2]]
+                                    for b, i in enumerate(chunk)]).astype('int64')
+            value = np.concatenate([graphs[i][0][:, 2:] for i in chunk])
+            batch = torch.sparse_coo_tensor(torch.tensor(index.T), torch.tensor(value),
+                                            (len(chunk), m, m, num_feature))
+            L = forward(batch.float().to(device)).detach().cpu().double()
+            for b, i in enumerate(chunk):
+                out[i] = L[b]
+    return out
+
+
+def extend_spectra(spectra, size=None):
+    # Zero-extension convention for comparing spectra of different lengths.
+    size = max(len(s) for s in spectra) if size is None else size
+    E = torch.zeros((len(spectra), size), dtype=spectra[0].dtype)
+    for i, s in enumerate(spectra):
+        E[i, :len(s)] = s
+    return E
+
+
+def heat_trace_dist(f1, f2, tp, weights):
+    dmats = []
+    for tidx in range(tp.shape[0]):
+        eee1pr = torch.exp(f1 * torch.abs(tp[tidx])) * weights
+        eee2pr = torch.exp(f2 * torch.abs(tp[tidx])) * weights
+        dmats.append(torch.cdist(eee1pr, eee2pr))
+    return torch.stack(dmats).max(0)[0]
+
+
+class ClassBlocks:
+    # Per class pair sums, counts, min and max of the distances, accumulated
+    # tile by tile. Tiles come with their rows and columns grouped by class, so
+    # each block of a tile is reduced in place by reduceat.
+    def __init__(self, num_classes):
+        K = num_classes
+        self.sum = np.zeros((K, K))
+        self.count = np.zeros((K, K), dtype=np.int64)
+        self.min = np.full((K, K), np.inf)
+        self.max = np.full((K, K), -np.inf)
+
+    def add(self, dd, labels1, labels2, mirror=False):
+        s1 = np.flatnonzero(np.r_[True, labels1[1:] != labels1[:-1]])
+        s2 = np.flatnonzero(np.r_[True, labels2[1:] != labels2[:-1]])
+        l1, l2 = labels1[s1], labels2[s2]
+        n1, n2 = np.diff(np.r_[s1, len(labels1)]), np.diff(np.r_[s2, len(labels2)])
+        blocks = [(l1, l2, lambda x: x)] + ([(l2, l1, np.transpose)] if mirror else [])
+        for ufunc, table in ((np.add, self.sum), (np.minimum, self.min), (np.maximum, self.max)):
+            r = ufunc.reduceat(ufunc.reduceat(dd, s1, axis=0), s2, axis=1)
+            for a, b, f in blocks:
+                sub = table[np.ix_(a, b)]
+                table[np.ix_(a, b)] = sub + f(r) if ufunc is np.add else ufunc(sub, f(r))
+        for a, b, f in blocks:
+            self.count[np.ix_(a, b)] += f(np.outer(n1, n2))
+
+    @property
+    def mean(self):
+        with np.errstate(invalid='ignore', divide='ignore'):
+            return self.sum / self.count
+
+
+def distance_matrix(spectra, tp, weights=None, num_batches=30, size=None, device='cpu',
+                    labels=None, num_classes=None, store=True):
+    # Tiled max-over-scales heat-trace distance, as in the notebook experiments.
+    # Graphs are tiled in order of size, and each tile pair only uses the first
+    # max(n) columns: past that both zero-extended traces equal the weights, so
+    # they contribute nothing to the distance.
+    # With class labels (0..K-1) the class block table (new_dm_table) is
+    # accumulated from the tiles as they are produced, and (dmat, ClassBlocks)
+    # is returned; with store=False the matrix itself is never allocated
+    # (dmat is None).
+    sizes = np.array([len(s) for s in spectra])
+    E = extend_spectra(spectra, size).to(device)
+    tp = torch.as_tensor(tp, dtype=E.dtype, device=device)
+    weights = torch.ones(E.shape[1], dtype=E.dtype, device=device) if weights is None else \
+        torch.as_tensor(weights, dtype=E.dtype, device=device).reshape(-1)
+    index_batches = np.array_split(np.argsort(sizes, kind='stable'), num_batches)
+    blocks = None
+    if labels is not None:
+        labels = np.asarray(labels)
+        blocks = ClassBlocks(labels.max() + 1 if num_classes is None else num_classes)
+        # group each batch by class, so tile blocks are contiguous
+        index_batches = [b[np.argsort(labels[b], kind='stable')] for b in index_batches]
+    dmat = np.zeros((len(spectra), len(spectra))) if store or blocks is None else None
+    with torch.no_grad():
+        for i1 in range(len(index_batches)):
+            for i2 in range(i1, len(index_batches)):
+                idxs1 = index_batches[i1]
+                idxs2 = index_batches[i2]
+                if len(idxs1) == 0 or len(idxs2) == 0:
+                    continue
+                m = max(sizes[idxs1].max(), sizes[idxs2].max(), 1)
+                dd = heat_trace_dist(E[idxs1, :m], E[idxs2, :m], tp, weights[:m]).cpu().numpy()
+                if blocks is not None:
+                    blocks.add(dd, labels[idxs1], labels[idxs2], mirror=i1 != i2)
+                if dmat is not None:
+                    dmat[np.ix_(idxs1, idxs2)] = dd
+                    dmat[np.ix_(idxs2, idxs1)] = dd.T
+    return dmat if blocks is None else (dmat, blocks)
+
+
+# ---------------------------------------------------------------------------
+# kNN queries with float32 screening and float64 refinement.
+#
+# The float32 pass evaluates the distances of all pairs from Gram matrices
+# (|a|^2 + |b|^2 - 2ab, one sgemm per scale) and brackets every float64
+# distance within a rigorous error bound. Only references whose lower bound can
+# still reach the k-th smallest upper bound are refined in float64, by direct
+# differences with one contiguous row per pair, so the float64 value of a pair
+# does not depend on which other pairs are refined with it. The returned
+# neighbours and distances are bit-identical to the full float64 pass
+# (screen=False).
+
+_U32 = float(np.finfo(np.float32).eps) / 2
+
+
+def _as_extended(spectra, size):
+    E = np.zeros((len(spectra), size))
+    for i, s in enumerate(spectra):
+        s = np.asarray(s, dtype=np.float64)
+        E[i, :len(s)] = s
+    return E
+
+
+def _heat_features(E, t, w):
+    # exp(|t| * lambda) * w, the per-scale vectors compared by the distance
+    return np.exp(E * E.dtype.type(abs(t))) * w
+
+
+def _row_dist(d):
+    return np.sqrt((d * d).sum(-1))
+
+
+def _screen_bounds(Fq, Fr, feat_err, m):
+    # Lower and upper bounds on the float64 distances from float32 features.
+    # Each float32 feature is within 6u w_i of the float64 one (rounding of
+    # lambda, t and their product: 3u |y| exp(y) <= 3u/e; exp < 4 ulp; weight
+    # product u), so distances move by at most 2*feat_err = 2 * 6u |w|. The Gram
+    # form of the squared distance is within (m+4)u (|a|^2 + |b|^2) of the exact
+    # one for the float32 vectors.
+    na = np.einsum('ij,ij->i', Fq, Fq, dtype=np.float64)
+    nb = np.einsum('ij,ij->i', Fr, Fr, dtype=np.float64)
+    d2 = na[:, None] + nb[None, :] - 2 * (Fq @ Fr.T).astype(np.float64)
+    e2 = (m + 4) * _U32 * (na[:, None] + nb[None, :]) * 1.01
+    lower = np.sqrt(np.maximum(d2 - e2, 0)) - 2 * feat_err
+    upper = np.sqrt(np.maximum(d2 + e2, 0)) + 2 * feat_err
+    return lower, upper
+
+
+def knn(query_spectra, ref_spectra, tp, k, weights=None, screen=True, block_elems=1 << 22):
+    # k nearest references (ascending distance, ties by index) of each query
+    # under the max-over-scales heat-trace distance. Returns (index, distance,
+    # stats); stats gives the fraction of pairs refined in float64.
+    size = max(max(len(s) for s in query_spectra), max(len(s) for s in ref_spectra), 1)
+    Eq, Er = _as_extended(query_spectra, size), _as_extended(ref_spectra, size)
+    tp = np.abs(np.asarray(tp, dtype=np.float64)).reshape(-1)
+    w = np.ones(size) if weights is None else np.asarray(weights, dtype=np.float64).reshape(-1)[:size]
+    nq, nr = Eq.shape[0], Er.shape[0]
+    k = min(k, nr)
+    Eq32, Er32, w32 = Eq.astype(np.float32), Er.astype(np.float32), w.astype(np.float32)
+    # float64 rounding of the refined distances is covered by a tiny extra margin
+    feat_err = 6 * _U32 * float(np.sqrt((w ** 2).sum())) * 1.01 + 1e-12
+
+    index = np.zeros((nq, k), dtype=np.int64)
+    dist = np.zeros((nq, k))
+    num_refined = 0
+    qb = max(1, block_elems // max(nr * size, 1))
+    for q0 in range(0, nq, qb):
+        q = np.arange(q0, min(q0 + qb, nq))
+        if screen:
+            lower = np.zeros((len(q), nr))
+            upper = np.zeros((len(q), nr))
+            for t in tp:
+                lo, up = _screen_bounds(_heat_features(Eq32[q], t, w32),
+                                        _heat_features(Er32, t, w32), feat_err, size)
+                np.maximum(lower, lo, out=lower)
+                np.maximum(upper, up, out=upper)
+            kth = np.partition(upper, k - 1, axis=1)[:, k - 1:k]
+            qi, ri = np.nonzero(lower <= kth)
+        else:
+            qi, ri = np.repeat(np.arange(len(q)), nr), np.tile(np.arange(nr), len(q))
+        num_refined += len(qi)
+        D64 = np.zeros(len(qi))
+        for t in tp:
+            Fq, Fr = _heat_features(Eq[q], t, w), _heat_features(Er, t, w)
+            np.maximum(D64, _row_dist(Fq[qi] - Fr[ri]), out=D64)
+        starts = np.searchsorted(qi, np.arange(len(q) + 1))
+        for b in range(len(q)):
+            r, d = ri[starts[b]:starts[b + 1]], D64[starts[b]:starts[b + 1]]
+            order = np.argsort(d, kind='stable')[:k]
+            index[q[b]], dist[q[b]] = r[order], d[order]
+    return index, dist, {'refined_fraction': num_refined / max(nq * nr, 1)}
+
+
+# ---------------------------------------------------------------------------
+# Pruning of the diffusion-time grid.
+#
+# For almost all pairs the max over scales is attained at a handful of the
+# grid scales. prune_scales() records the maximizing scale of a calibration
+# sample of pairs and keeps scales until the distances of the sample are within
+# rtol of the full-grid ones (relative to max(distance, median distance), such
+# that pairs of almost identical graphs do not dominate). pruned_distance_matrix()
+# evaluates only the kept scales and bounds the error at the dropped grid scales
+# for every pair: in u = log t the distance is Lipschitz with constant
+# min(t |w (la - lb)|, |w|/e), since x exp(x) has slope at most 1 and magnitude
+# at most 1/e for x <= 0, so the dropped scales are bounded from the two kept
+# scales around them, and by t |w (la - lb)| itself. With certify=True, where
+# this bound exceeds rtol times the distance of a pair, the middle scale of the
+# gap is evaluated for the pair and both halves are bounded again, so every pair
+# is certified within rtol of the full grid. The bound is loose for smooth
+# profiles (almost every pair gets refined, slower than the full grid), so by
+# default only the kept scales are evaluated and the deviation is measured on
+# random pairs evaluated on the full grid.
+
+
+def _gram_dist(Fa, Fb):
+    # float64 distances between all rows of Fa and Fb (Gram form)
+    d2 = (Fa * Fa).sum(1)[:, None] + (Fb * Fb).sum(1)[None, :] - 2 * Fa @ Fb.T
+    return np.sqrt(np.maximum(d2, 0))
+
+
+def _scale_dists(Ea, Eb, t, w):
+    return _gram_dist(_heat_features(Ea, t, w), _heat_features(Eb, t, w))
+
+
+def scale_profile(Ea, Eb, tp, weights):
+    # Distances of the row pairs (Ea[p], Eb[p]) at every scale, shape (pairs, scales)
+    out = np.empty((Ea.shape[0], len(tp)))
+    for s, t in enumerate(tp):
+        out[:, s] = _row_dist(_heat_features(Ea, t, weights) - _heat_features(Eb, t, weights))
+    return out
+
+
+def prune_scales(spectra, tp, weights=None, num_pairs=2000, rtol=1e-2, seed=0):
+    # Reduced scale set from the maximizing scales of random pairs. Returns a
+    # dict with the kept scale indices (ascending), the argmax counts over the
+    # full grid, and the worst relative deviation left on the sample.
+    size = max(max(len(s) for s in spectra), 1)
+    E = _as_extended(spectra, size)
+    tp = np.abs(np.asarray(tp, dtype=np.float64)).reshape(-1)
+    w = np.ones(size) if weights is None else np.asarray(weights, dtype=np.float64).reshape(-1)[:size]
+    rng = np.random.default_rng(seed)
+    i, j = rng.integers(len(E), size=num_pairs), rng.integers(len(E), size=num_pairs)
+    i, j = i[i != j], j[i != j]
+    profile = scale_profile(E[i], E[j], tp, w)
+    full = profile.max(1)
+    argmax = profile.argmax(1)
+    counts = np.bincount(argmax, minlength=len(tp))
+    scale = np.maximum(full, max(np.median(full), np.finfo(np.float64).tiny))
+
+    keep = [int(counts.argmax())]
+    current = profile[:, keep[0]].copy()
+    while True:
+        deviation = (full - current) / scale
+        worst = int(deviation.argmax())
+        if deviation[worst] <= rtol:
+            break
+        keep.append(int(argmax[worst]))
+        np.maximum(current, profile[:, keep[-1]], out=current)
+    return {'keep': np.sort(np.array(keep)), 'counts': counts,
+            'calibration_max_deviation': float(deviation.max()),
+            'median_distance': float(np.median(full)), 'num_pairs': len(i)}
+
+
+def _gap_bound(Ea, Eb, wm, tp, u, delta, cap, dd, refined, r, c, left, right, lo, hi,
+               d_left, d_right, rtol):
+    # Bound on the distances of the pairs (r, c) at the grid scales lo..hi from
+    # their distances d_left, d_right at the evaluated scales left, right around
+    # them (-1 / None at the ends of the grid). Where the bound exceeds rtol dd,
+    # the middle scale is evaluated, dd raised, and both halves bounded again.
+    # The Lipschitz constant increases with t: take it at the largest scale.
+    dl = delta[r, c]
+    lip = np.minimum(tp[hi if right is None else right] * dl, cap)
+    if left < 0:
+        b = d_right + lip * (u[right] - u[lo])
+    elif right is None:
+        b = d_left + lip * (u[hi] - u[left])
+    else:
+        # max over the gap of the smaller of the two one-sided bounds
+        b = np.minimum((d_left + d_right + lip * (u[right] - u[left])) / 2,
+                       np.minimum(d_left + lip * (u[hi] - u[left]),
+                                  d_right + lip * (u[right] - u[lo])))
+    # |exp(ta) - exp(tb)| <= t |a - b| for a, b <= 0
+    np.minimum(b, tp[hi] * dl, out=b)
+    loose = np.flatnonzero(b - dd[r, c] > rtol * dd[r, c])
+    if len(loose) == 0:
+        return b
+    mid = (lo + hi) // 2
+    r, c = r[loose], c[loose]
+    d_mid = _row_dist(_heat_features(Ea[r], tp[mid], wm) - _heat_features(Eb[c], tp[mid], wm))
+    dd[r, c] = np.maximum(dd[r, c], d_mid)
+    refined[r, c] += 1
+    b_mid = d_mid.copy()
+    if lo < mid:
+        np.maximum(b_mid, _gap_bound(Ea, Eb, wm, tp, u, delta, cap, dd, refined, r, c, left, mid,
+                                     lo, mid - 1, None if left < 0 else d_left[loose], d_mid,
+                                     rtol), out=b_mid)
+    if mid < hi:
+        np.maximum(b_mid, _gap_bound(Ea, Eb, wm, tp, u, delta, cap, dd, refined, r, c, mid, right,
+                                     mid + 1, hi, d_mid,
+                                     None if right is None else d_right[loose], rtol), out=b_mid)
+    b[loose] = b_mid
+    return b
+
+
+def pruned_distance_matrix(spectra, tp, keep, weights=None, num_batches=30, rtol=1e-2,
+                           num_check_pairs=1000, seed=1, certify=False):
+    # Max-over-scales distance on the kept scales. Returns (dmat, stats): stats
+    # holds the worst deviation observed on random pairs evaluated on the full
+    # grid. With certify=True, also the dropped scales needed to certify each
+    # pair within rtol of the full grid are evaluated, and stats holds the
+    # largest certified bound on the error over all pairs (absolute, and
+    # relative to the distance, <= rtol), the fraction of pairs evaluated on
+    # dropped scales and the mean number of dropped scales evaluated per pair.
+    sizes = np.array([len(s) for s in spectra])
+    size = max(sizes.max(), 1)
+    E = _as_extended(spectra, size)
+    tp = np.abs(np.asarray(tp, dtype=np.float64)).reshape(-1)
+    w = np.ones(size) if weights is None else np.asarray(weights, dtype=np.float64).reshape(-1)[:size]
+    keep = np.sort(np.asarray(keep))
+    u = np.log(tp)
+    # gaps of dropped grid scales: (left kept, right kept, first and last dropped),
+    # with -1 / None for the gaps before the first and after the last kept scale
+    gaps = []
+    bounds = [-1] + list(keep) + [None]
+    for left, right in zip(bounds[:-1], bounds[1:]):
+        lo, hi = left + 1, len(tp) - 1 if right is None else right - 1
+        if lo <= hi:
+            gaps.append((left, right, lo, hi))
+    index_batches = np.array_split(np.argsort(sizes, kind='stable'), num_batches)
+    dmat = np.zeros((len(E), len(E)))
+    max_bound, max_rel_bound, num_refined, num_extra = 0.0, 0.0, 0, 0
+    for i1 in range(len(index_batches)):
+        for i2 in range(i1, len(index_batches)):
+            idxs1, idxs2 = index_batches[i1], index_batches[i2]
+            if len(idxs1) == 0 or len(idxs2) == 0:
+                continue
+            m = max(sizes[idxs1].max(), sizes[idxs2].max(), 1)
+            Ea, Eb, wm = E[idxs1, :m], E[idxs2, :m], w[:m]
+            d = [_scale_dists(Ea, Eb, tp[s], wm) for s in keep]
+            dd = np.max(d, axis=0)
+            if certify and gaps:
+                delta = _gram_dist(Ea * wm, Eb * wm)
+                cap = np.sqrt((wm ** 2).sum()) / np.e
+                kept = dict(zip(keep, d))
+                r, c = (x.ravel() for x in np.indices(dd.shape))
+                bound = dd.copy()
+                refined = np.zeros(dd.shape, dtype=np.int64)
+                for left, right, lo, hi in gaps:
+                    b = _gap_bound(Ea, Eb, wm, tp, u, delta, cap, dd, refined, r, c, left, right,
+                                   lo, hi, None if left < 0 else kept[left].ravel(),
+                                   None if right is None else kept[right].ravel(), rtol)
+                    np.maximum(bound, b.reshape(dd.shape), out=bound)
+                excess = np.maximum(bound - dd, 0)
+                max_bound = max(max_bound, float(excess.max()))
+                with np.errstate(invalid='ignore', divide='ignore'):
+                    rel = np.where(excess > 0, excess / dd, 0.0)
+                max_rel_bound = max(max_rel_bound, float(rel.max()))
+                mirror = 1 if i1 == i2 else 2
+                num_refined += int((refined > 0).sum()) * mirror
+                num_extra += int(refined.sum()) * mirror
+            dmat[np.ix_(idxs1, idxs2)] = dd
+            dmat[np.ix_(idxs2, idxs1)] = dd.T
+
+    rng = np.random.default_rng(seed)
+    i, j = rng.integers(len(E), size=num_check_pairs), rng.integers(len(E), size=num_check_pairs)
+    full = scale_profile(E[i], E[j], tp, w).max(1)
+    stats = {'observed_max_deviation': float(np.abs(full - dmat[i, j]).max()) if len(i) else 0.0}
+    if certify:
+        stats.update({'max_certified_error': max_bound, 'max_certified_rel_error': max_rel_bound,
+                      'refined_fraction': num_refined / max(len(E) ** 2, 1),
+                      'extra_scales_per_pair': num_extra / max(len(E) ** 2, 1)})
+    return dmat, stats
+
+
+# ---------------------------------------------------------------------------
+# kNN accuracy for all k of the validation loop.
+#
+# Same classifier as KNeighborsClassifier(k, metric='precomputed',
+# weights='distance'): weights 1/d, or only the neighbours at distance 0 if
+# there are any, ties to the smallest class. The k_max nearest references of
+# each query are selected and sorted once (by distance, then index), and the
+# predictions for all k follow from running class scores. Uses knn_eval.cc
+# when libknneval.so has been built next to this file:
+#
+#   g++ -O2 -shared -fPIC -pthread knn_eval.cc -o libknneval.so
+
+try:
+    import ctypes
+    _knn_lib = np.ctypeslib.load_library('libknneval', os.path.dirname(os.path.abspath(__file__)))
+    _knn_lib.knn_accuracy_curve.restype = ctypes.c_int
+    _knn_lib.knn_accuracy_curve.argtypes = (
+        [np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')] + [ctypes.c_int] * 2 +
+        [np.ctypeslib.ndpointer(np.int32, flags='C_CONTIGUOUS')] * 2 + [ctypes.c_int] * 4 +
+        [np.ctypeslib.ndpointer(np.float64, flags='C_CONTIGUOUS')])
+except OSError:
+    _knn_lib = None
+
+
+def _knn_accuracy_numpy(dist, ref, query, num_classes, k_min, k_max):
+    nq = dist.shape[0]
+    # the k_max smallest per row, ordered by distance then index
+    part = np.sort(np.argpartition(dist, k_max - 1, axis=1)[:, :k_max], axis=1)
+    d = np.take_along_axis(dist, part, 1)
+    # ties at the k_max-th distance may have left out smaller indices
+    kth = d.max(1, keepdims=True)
+    if np.any((dist == kth).sum(1) > (d == kth).sum(1)):
+        part = np.argsort(dist, axis=1, kind='stable')[:, :k_max]
+        d = np.take_along_axis(dist, part, 1)
+    order = np.argsort(d, axis=1, kind='stable')
+    part, d = np.take_along_axis(part, order, 1), np.take_along_axis(d, order, 1)
+    onehot = np.zeros((nq, k_max, num_classes))
+    np.put_along_axis(onehot, ref[part][:, :, None], 1.0, 2)
+    zero = d == 0
+    with np.errstate(divide='ignore'):
+        inverse = np.where(zero, 0.0, 1.0 / d)
+    zscore = np.cumsum(onehot * zero[:, :, None], 1)
+    iscore = np.cumsum(onehot * inverse[:, :, None], 1)
+    score = np.where(np.cumsum(zero, 1)[:, :, None] > 0, zscore, iscore)
+    correct = score.argmax(2) == query[:, None]
+    return correct.mean(0)[k_min - 1:]
+
+
+def knn_accuracy_curve(dist, ref_labels, query_labels, k_min=3, k_max=49, num_threads=0):
+    # dist: (num_query, num_ref) distances from the validation to the training
+    # graphs. Returns [(k, accuracy)] for k_min..k_max and the best k (the
+    # largest one attaining the best accuracy).
+    dist = np.ascontiguousarray(dist, dtype=np.float64)
+    classes, labels = np.unique(np.concatenate([ref_labels, query_labels]), return_inverse=True)
+    ref = labels[:len(ref_labels)].astype(np.int32)
+    query = labels[len(ref_labels):].astype(np.int32)
+    k_max = min(k_max, dist.shape[1])
+    if _knn_lib is not None:
+        acc = np.zeros(k_max - k_min + 1)
+        _knn_lib.knn_accuracy_curve(dist, dist.shape[0], dist.shape[1], ref, query, len(classes),
+                                    k_min, k_max, num_threads, acc)
+    else:
+        acc = _knn_accuracy_numpy(dist, ref, query, len(classes), k_min, k_max)
+    curve = [(k, float(a)) for k, a in zip(range(k_min, k_max + 1), acc)]
+    best = max(curve, key=lambda ka: (ka[1], ka[0]))[0]
+    return curve, best
+
+
+# ---------------------------------------------------------------------------
+# Parameter inference from the nearest simulated graphs.
+#
+# The sweep coordinates of the simulated graphs (k_force of
+# VertexFromWallSpring; Lwall_threshold and the two random division rates of
+# Division::ShortestPath2DRandomized) are numeric metadata, one row per model,
+# written by gen_sim_files.py. For each query graph the k nearest simulated
+# graphs give the parameters of the nearest one (nearest_param_vec in the
+# notebook), their mean (nearest_param_consensus, k=30) and spread, and the
+# distribution over the grid values of each parameter.
+
+SIM_PARAM_NAMES = ('k_force', 'Lwall_threshold', 'RandDivFreq', 'RandDivLocFreq')
+
+
+def load_sim_params(fn="sim_params.txt"):
+    # model name (s<i>_s<j>_s<k>_s<l>) -> parameter vector
+    with open(fn) as f:
+        rows = [line.split() for line in f if line.strip()]
+    return {r[0]: np.array(r[1:], dtype=np.float64) for r in rows}
+
+
+def param_summary(index, dist, sim_params):
+    # index, dist: (num_query, k) nearest simulated graphs; sim_params: their
+    # (num_sim, num_params) metadata
+    sim_params = np.asarray(sim_params, dtype=np.float64)
+    P = sim_params[index]
+    distribution = []
+    for p in range(sim_params.shape[1]):
+        values = np.unique(sim_params[:, p])
+        distribution.append((values, (P[:, :, p, None] == values).mean(1)))
+    return {'nearest': P[:, 0], 'consensus': P.mean(1), 'std': P.std(1),
+            'distribution': distribution, 'index': index, 'distance': dist}
+
+
+def infer_params(query_spectra, sim_spectra, sim_params, tp, k=30, weights=None,
+                 num_threads=0, block=256):
+    # Nearest simulated graphs of each query from knn(), on query blocks in
+    # parallel (numpy releases the GIL in the distance kernels)
+    from concurrent.futures import ThreadPoolExecutor
+    blocks = [list(range(q0, min(q0 + block, len(query_spectra))))
+              for q0 in range(0, len(query_spectra), block)]
+
+    def run(q):
+        return knn([query_spectra[i] for i in q], sim_spectra, tp, k, weights)[:2]
+    with ThreadPoolExecutor(num_threads or None) as pool:
+        results = list(pool.map(run, blocks))
+    index = np.concatenate([r[0] for r in results])
+    dist = np.concatenate([r[1] for r in results])
+    return param_summary(index, dist, sim_params)
+
+
+def infer_params_from_rows(dist_rows, sim_params, k=30):
+    # Same from precomputed distances to the simulated graphs (e.g. a learned
+    # distance), selecting the k nearest per row without sorting the rows
+    dist_rows = np.asarray(dist_rows, dtype=np.float64)
+    k = min(k, dist_rows.shape[1])
+    part = np.sort(np.argpartition(dist_rows, k - 1, axis=1)[:, :k], axis=1)
+    d = np.take_along_axis(dist_rows, part, 1)
+    order = np.argsort(d, axis=1, kind='stable')
+    index, d = np.take_along_axis(part, order, 1), np.take_along_axis(d, order, 1)
+    return param_summary(index, d, sim_params)
+
+
+# ---------------------------------------------------------------------------
+# Per-node and per-edge features from the eigendecomposition.
+#
+# With the eigenvectors U of the Laplacian, one eigendecomposition per graph
+# (batched per exact size, so the eigenvectors are those of the graph alone)
+# gives, at the distance's scales tp and eigen-weights w, the heat kernel
+# signature of each node, sum_k w_k exp(|t| lambda_k) U_xk^2 (the diagonal of
+# the weighted heat kernel whose trace the distance compares), and for each
+# edge (i, j) the entry L_ij F_ij of the filtered Laplacian drawn by
+# graph_plot_from_idx, for F = U diag(w lambda) U^T and for the heat kernels
+# F = U diag(w exp(|t| lambda)) U^T.
+
+def ragged_eigh(lapls, device='cpu'):
+    # (eigenvalues ascending, eigenvectors as columns) of each Laplacian, with
+    # one batched eigh per size
+    sizes = np.array([L.shape[0] for L in lapls])
+    out = [None] * len(lapls)
+    for m, idxs in size_buckets(sizes).items():
+        batch = torch.stack([lapls[i] for i in idxs]).to(device)
+        if m == 0:
+            # graphs without nodes
+            eigs, vecs = batch.sum(-1), batch
+        else:
+            eigs, vecs = torch.linalg.eigh(batch)
+        eigs, vecs = eigs.cpu(), vecs.cpu()
+        for b, i in enumerate(idxs):
+            out[i] = (eigs[b], vecs[b])
+    return out
+
+
+def _filter_coefficients(evals, tp, weights):
+    # (1 + scales, n): w lambda, then w exp(|t| lambda) for every scale
+    w = torch.ones(len(evals), dtype=evals.dtype) if weights is None else \
+        torch.as_tensor(np.asarray(weights, dtype=np.float64).ravel()[:len(evals)], dtype=evals.dtype)
+    t = torch.abs(torch.as_tensor(np.asarray(tp, dtype=np.float64), dtype=evals.dtype))
+    return torch.cat([(w * evals).unsqueeze(0), torch.exp(t.unsqueeze(1) * evals.unsqueeze(0)) * w])
+
+
+def heat_kernel_signatures(evals, evecs, tp, weights=None):
+    # (n, scales)
+    return torch.matmul(evecs * evecs, _filter_coefficients(evals, tp, weights)[1:].T)
+
+
+def edge_filters(evals, evecs, lapl, edges, tp, weights=None):
+    # (edges, 1 + scales) for the edge list (i, j, ...) of the graph
+    i, j = edges[:, 0].astype('int'), edges[:, 1].astype('int')
+    F = torch.matmul(evecs[i] * evecs[j], _filter_coefficients(evals, tp, weights).T)
+    return lapl[i, j].unsqueeze(1) * F
+
+
+def spectral_node_features(graphs, tp, weights=None, col=-1, device='cpu'):
+    # graphs: list of (edges, n) as from load_graph(). Returns, per graph, the
+    # spectrum, the heat kernel signatures and the edge filter maps, all from the
+    # same eigendecomposition
+    lapls = [laplacian(edges, n, col) for edges, n in graphs]
+    out = []
+    for (edges, n), L, (evals, evecs) in zip(graphs, lapls, ragged_eigh(lapls, device)):
+        out.append((evals, heat_kernel_signatures(evals, evecs, tp, weights),
+                    edge_filters(evals, evecs, L, edges, tp, weights)))
+    return out
+
+
+if __name__ == '__main__':
+    # Full grid against pruned scales on random Delaunay cell graphs (1200
+    # graphs of 20-120 nodes, 128 scales as in the notebook)
+    import time
+    from scipy.spatial import Delaunay
+    rng = np.random.default_rng(0)
+    lapls = []
+    for _ in range(1200):
+        n = int(rng.integers(20, 120))
+        tri = Delaunay(rng.random((n, 2)) * [1, rng.uniform(0.3, 1)]).simplices
+        edges = np.concatenate([tri[:, [0, 1]], tri[:, [1, 2]], tri[:, [2, 0]]])
+        edges = np.unique(np.sort(edges, 1), axis=0)
+        edges = np.c_[np.r_[edges, edges[:, ::-1]], np.ones(2 * len(edges))]
+        lapls.append(laplacian(edges, n))
+    spectra = ragged_spectra(lapls)
+    tp = np.exp(np.linspace(-3, 3, 128))
+    start = time.perf_counter()
+    full = distance_matrix(spectra, tp)
+    t_full = time.perf_counter() - start
+    spectra = [s.numpy() for s in spectra]
+    start = time.perf_counter()
+    pruned = prune_scales(spectra, tp, num_pairs=20000, rtol=1e-2)
+    t_prune = time.perf_counter() - start
+    start = time.perf_counter()
+    dmat, stats = pruned_distance_matrix(spectra, tp, pruned['keep'], rtol=1e-2)
+    t_pruned = time.perf_counter() - start
+    rel = np.abs(full - dmat) / np.maximum(full, np.median(full))
+    print('full grid (%d scales)     %7.2f s' % (len(tp), t_full))
+    print('prune_scales               %7.2f s  (%d scales kept)' % (t_prune, len(pruned['keep'])))
+    print('pruned_distance_matrix     %7.2f s  (max relative deviation %.2e, observed %.2e)'
+          % (t_pruned, rel.max(), stats['observed_max_deviation']))
@@ -11,6 +11,8 @@
 #include"baseCompartmentChange.h"
 #include"compartmentDivision.h"
 #include"compartmentRemoval.h"
+#include"compartmentRemovalBatch.h"
+#include"compartmentStatistics.h"
 
 BaseCompartmentChange::~BaseCompartmentChange(){}
 
@@ -121,8 +123,18 @@ createCompartmentChange(std::vector<double> &paraValue,
 	  return new RemoveFoldedCells(paraValue, indValue);
   else if (idValue == "RemoveRegionOutsideRadius2D")
 	  return new RemoveRegionOutsideRadius2D(paraValue, indValue);
+  //compartmentRemovalBatch.h
+  else if (idValue == "Batched::RemovalIndex" ||
+	   idValue == "Batched::RemovalOutsideRadius" ||
+	   idValue == "Batched::RemovalOutsidePosition")
+	  return new BatchedRemoval(createCompartmentChange(paraValue, indValue,
+							    idValue.substr(9)));
 
 
+  //checkpoint.h
+  else if (idValue == "Checkpoint")
+	  return new CheckpointStep(paraValue, indValue);
+
   //Default, if nothing found
   else {
     std::cerr << std::endl << "BaseCompartmentChange::createCompartmentChange()"
@@ -156,7 +168,7 @@ BaseCompartmentChange::createCompartmentChange(std::istream &IN ) {
     for( size_t j=0 ; j<varIndexNum[i] ; j++ )
       IN >> varIndexVal[i][j];
   
-  return createCompartmentChange(pVal,varIndexVal,idVal);
+  return ObservedCompartmentChange::observe(createCompartmentChange(pVal,varIndexVal,idVal));
 }
 
 int BaseCompartmentChange::
@@ -0,0 +1,52 @@
+//
+// Filename     : cellShapeFeatures.cc
+// Description  : Per-cell shape features of a tissue for morphology analysis
+// Revision     : $Id:$
+//
+// Compile (from tissue_mod, linking the Tissue objects built with the modified files):
+//
+//   g++ -O2 -I. -I<tissue>/src benchmark/cellShapeFeatures.cc <tissue>/build/*.o -o cellShapeFeatures
+//
+// Computes the shape tensors of all cells of an init file (e.g. the final state of a run
+// written by the simulator with -init_output) with CellShape::ShapeTensors, and writes one
+// row per cell to the output file (standard output if not given):
+//
+//   cellShapeFeatures <init file> [<output file>]
+//
+// with the columns of ShapeTensors::print(), after a header line.
+//
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "tissue.h"
+#include "cellShape.h"
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {
+    std::cerr << "Usage: cellShapeFeatures <init file> [<output file>]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  Tissue T;
+  T.readInit(argv[1]);
+  DataMatrix vertexData(T.numVertex());
+  for (size_t v=0; v<T.numVertex(); ++v)
+    for (size_t d=0; d<T.vertex(v).numPosition(); ++d)
+      vertexData[v].push_back(T.vertex(v).position(d));
+
+  CellShape::ShapeTensors shape;
+  shape.compute(T, vertexData);
+  std::ofstream file;
+  if (argc == 3) {
+    file.open(argv[2]);
+    if (!file) {
+      std::cerr << "cellShapeFeatures: Cannot open file " << argv[2] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream &os = argc == 3 ? file : std::cout;
+  os << "cell lambda1 lambda2 lambda3 axisX axisY axisZ anisotropy elongation" << std::endl;
+  shape.print(os);
+  return 0;
+}
@@ -0,0 +1,200 @@
+//
+// Filename     : divisionReplay.cc
+// Description  : Golden output regression and timing of division rules on recorded events
+// Revision     : $Id:$
+//
+// Compile (from tissue_mod, linking the Tissue objects built with the modified files):
+//
+//   g++ -O2 -I. -I<tissue>/src benchmark/divisionReplay.cc <tissue>/build/*.o -o divisionReplay
+//
+// or build and run it on the golden records in benchmark/golden with the Makefile
+// (make TISSUE=<tissue> golden to capture them from simulator runs of golden/*.model,
+// and make TISSUE=<tissue> test, from tissue_mod/benchmark). Record events from real runs
+// by setting TISSUE_DIVISION_RECORD=<file>, and TISSUE_DIVISION_RECORD_SEED=1 for rules
+// drawing random numbers (see divisionRecord.h), and run
+//
+//   divisionReplay [-tol <relative tolerance>] <file> ...
+//
+// Each recorded update is replayed on a tissue holding only the recorded cell,
+// with the recorded random seed if any, and the division (whether the cell divided,
+// which walls were split and where the new vertices were placed) is compared
+// with the recorded one, with a tolerance relative to the cell size (default
+// 1e-9). Mean update times are printed per rule. Returns EXIT_FAILURE if any
+// replayed division differs, and can be run after changes to the division
+// kernels to verify that they still choose the same walls and positions.
+//
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "tissue.h"
+#include "baseCompartmentChange.h"
+#include "divisionRecord.h"
+#include "myRandom.h"
+
+// Writes the recorded cell as a Tissue init file (one cell, walls to the background)
+static void writeInit(const DivisionRecord &r, const std::string &fileName)
+{
+  std::ofstream OUT(fileName.c_str());
+  OUT.precision(17);
+  OUT << "1 " << r.wall.size() << " " << r.vertex.size() << std::endl;
+  for (size_t w=0; w<r.wall.size(); ++w)
+    OUT << w << " 0 -1 " << r.wallVertex[2*w] << " " << r.wallVertex[2*w+1] << std::endl;
+  OUT << std::endl << r.vertex.size() << " " << r.vertex[0].size() << std::endl;
+  for (size_t v=0; v<r.vertex.size(); ++v) {
+    for (size_t d=0; d<r.vertex[v].size(); ++d)
+      OUT << r.vertex[v][d] << " ";
+    OUT << std::endl;
+  }
+  OUT << std::endl << r.wall.size() << " " << r.wall[0].size() << std::endl;
+  for (size_t w=0; w<r.wall.size(); ++w) {
+    for (size_t k=0; k<r.wall[w].size(); ++k)
+      OUT << r.wall[w][k] << " ";
+    OUT << std::endl;
+  }
+  OUT << std::endl << "1 " << r.cell.size() << std::endl;
+  for (size_t k=0; k<r.cell.size(); ++k)
+    OUT << r.cell[k] << " ";
+  OUT << std::endl;
+}
+
+static double distance(const std::vector<double> &a, const std::vector<double> &b)
+{
+  double sum = 0.0;
+  for (size_t d=0; d<a.size() && d<b.size(); ++d)
+    sum += (a[d]-b[d])*(a[d]-b[d]);
+  return std::sqrt(sum);
+}
+
+// Distance between two unordered pairs of rows
+static double pairDistance(const DataMatrix &a, const DataMatrix &b)
+{
+  if (a.size() != b.size())
+    return HUGE_VAL;
+  if (a.size() != 2)
+    return a.size() ? distance(a[0], b[0]) : 0.0;
+  return std::min(std::max(distance(a[0], b[0]), distance(a[1], b[1])),
+		  std::max(distance(a[0], b[1]), distance(a[1], b[0])));
+}
+
+// Split wall end points are compared as unordered pairs within each wall
+static double wallDistance(const std::vector<double> &a, const std::vector<double> &b)
+{
+  size_t n = a.size()/2;
+  std::vector<double> a1(a.begin(), a.begin()+n), a2(a.begin()+n, a.end());
+  std::vector<double> b1(b.begin(), b.begin()+n), b2(b.begin()+n, b.end());
+  return std::min(std::max(distance(a1, b1), distance(a2, b2)),
+		  std::max(distance(a1, b2), distance(a2, b1)));
+}
+
+struct RuleTiming {
+  size_t numRecord, numMismatch;
+  double seconds;
+};
+
+int main(int argc, char *argv[])
+{
+  double tolerance = 1e-9;
+  std::vector<std::string> fileName;
+  for (int a=1; a<argc; ++a) {
+    if (std::strcmp(argv[a], "-tol") == 0 && a+1 < argc)
+      tolerance = std::atof(argv[++a]);
+    else
+      fileName.push_back(argv[a]);
+  }
+  if (fileName.empty()) {
+    std::cerr << "Usage: divisionReplay [-tol <relative tolerance>] <record file> ..."
+	      << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string initName = "divisionReplay." + std::to_string(getpid()) + ".init";
+
+  std::map<std::string, RuleTiming> timing;
+  size_t numRecord = 0, numMismatch = 0;
+  for (size_t f=0; f<fileName.size(); ++f) {
+    std::ifstream IN(fileName[f].c_str());
+    if (!IN) {
+      std::cerr << "divisionReplay: Cannot open file " << fileName[f] << std::endl;
+      return EXIT_FAILURE;
+    }
+    DivisionRecord r;
+    while (r.read(IN)) {
+      writeInit(r, initName);
+      Tissue T;
+      T.readInit(initName.c_str());
+      size_t numWallOld = T.numWall(), numVertexOld = T.numVertex();
+
+      DataMatrix vertexData(r.vertex), wallData(r.wall), cellData(1, r.cell);
+      DataMatrix vertexDerivs(vertexData.size(), std::vector<double>(r.vertex[0].size(), 0.0));
+      DataMatrix wallDerivs(wallData.size(), std::vector<double>(r.wall[0].size(), 0.0));
+      DataMatrix cellDerivs(1, std::vector<double>(r.cell.size(), 0.0));
+      BaseCompartmentChange *rule =
+	BaseCompartmentChange::createCompartmentChange(r.parameter, r.variableIndex, r.id);
+
+      if (r.seed)
+	myRandom::sran3(r.seed);
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      rule->update(&T, 0, cellData, wallData, vertexData, cellDerivs, wallDerivs, vertexDerivs);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      delete rule;
+
+      // Split walls are the old walls now ending at a new vertex
+      DataMatrix splitWall, newVertex;
+      if (T.numCell() == 2 && T.numVertex() == numVertexOld+2) {
+	for (size_t v=numVertexOld; v<T.numVertex(); ++v)
+	  newVertex.push_back(vertexData[v]);
+	for (size_t w=0; w<numWallOld; ++w) {
+	  size_t v1 = T.wall(w).vertex1()->index(), v2 = T.wall(w).vertex2()->index();
+	  if (v1 >= numVertexOld || v2 >= numVertexOld) {
+	    std::vector<double> end(r.vertex[r.wallVertex[2*w]]);
+	    const std::vector<double> &end2 = r.vertex[r.wallVertex[2*w+1]];
+	    end.insert(end.end(), end2.begin(), end2.end());
+	    splitWall.push_back(end);
+	  }
+	}
+      }
+
+      double size = 0.0;
+      for (size_t v=1; v<r.vertex.size(); ++v)
+	size = std::max(size, distance(r.vertex[0], r.vertex[v]));
+      double tol = tolerance*(size > 0.0 ? size : 1.0);
+      int mismatch = int(T.numCell() == 2) != r.divided ||
+	splitWall.size() != r.splitWall.size() || pairDistance(newVertex, r.newVertex) > tol;
+      for (size_t k=0; !mismatch && k<r.splitWall.size(); ++k) {
+	double best = HUGE_VAL;
+	for (size_t l=0; l<splitWall.size(); ++l)
+	  best = std::min(best, wallDistance(r.splitWall[k], splitWall[l]));
+	mismatch = best > tol;
+      }
+
+      RuleTiming &t = timing[r.id];
+      ++t.numRecord;
+      t.seconds += elapsed.count();
+      ++numRecord;
+      if (mismatch) {
+	++t.numMismatch;
+	++numMismatch;
+	std::cerr << "divisionReplay: " << r.id << " record " << numRecord
+		  << " in " << fileName[f] << " differs from the golden division." << std::endl;
+      }
+    }
+  }
+  std::remove(initName.c_str());
+
+  std::cout << "rule numRecord numMismatch meanUpdate[us]" << std::endl;
+  for (std::map<std::string, RuleTiming>::const_iterator t=timing.begin(); t!=timing.end(); ++t)
+    std::cout << t->first << " " << t->second.numRecord << " " << t->second.numMismatch
+	      << " " << 1e6*t->second.seconds/t->second.numRecord << std::endl;
+  std::cout << numRecord-numMismatch << " of " << numRecord << " divisions reproduced"
+	    << std::endl;
+  return numMismatch ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,147 @@
+//
+// Filename     : hexTissue.h
+// Description  : Synthetic hexagonal tissue and sweeps for the benchmarks
+// Revision     : $Id:$
+//
+#ifndef HEXTISSUE_H
+#define HEXTISSUE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "myTypedefs.h"
+
+struct HexTissue {
+  std::vector< std::vector<size_t> > cellVertex;
+  std::vector< std::vector<size_t> > cellWall;
+  std::vector< std::vector<size_t> > wallVertex;
+  DataMatrix vertexData;
+};
+
+// Hexagonal cells on a (numX x numY) grid sharing vertices and walls. Vertex
+// indices (and cell order if shuffleCells) are shuffled as after many divisions.
+inline HexTissue hexTissue(size_t numX, size_t numY, bool shuffleCells=false)
+{
+  HexTissue T;
+  std::vector<double> position(2);
+  std::vector< std::vector<size_t> > vertexIndex(2*numX+2, std::vector<size_t>(numY+1));
+  for (size_t i=0; i<2*numX+2; ++i)
+    for (size_t j=0; j<numY+1; ++j) {
+      vertexIndex[i][j] = T.vertexData.size();
+      position[0] = 0.5*std::sqrt(3.0)*i;
+      position[1] = 1.5*j + ((i+j)%2 ? 0.5 : 0.0);
+      T.vertexData.push_back(position);
+    }
+  std::vector<size_t> wall(2);
+  for (size_t x=0; x<numX; ++x)
+    for (size_t y=0; y<numY; ++y) {
+      size_t i = 2*x + y%2;
+      std::vector<size_t> v(6);
+      v[0] = vertexIndex[i][y];
+      v[1] = vertexIndex[i+1][y];
+      v[2] = vertexIndex[i+2][y];
+      v[3] = vertexIndex[i+2][y+1];
+      v[4] = vertexIndex[i+1][y+1];
+      v[5] = vertexIndex[i][y+1];
+      T.cellVertex.push_back(v);
+      std::vector<size_t> w(6);
+      for (size_t k=0; k<6; ++k) {
+	wall[0] = v[k];
+	wall[1] = v[(k+1)%6];
+	w[k] = T.wallVertex.size();
+	T.wallVertex.push_back(wall);
+      }
+      T.cellWall.push_back(w);
+    }
+  // Shuffle vertex indices, as after many divisions
+  std::vector<size_t> perm(T.vertexData.size());
+  for (size_t k=0; k<perm.size(); ++k)
+    perm[k] = k;
+  std::srand(1);
+  for (size_t k=perm.size()-1; k>0; --k)
+    std::swap(perm[k], perm[std::rand()%(k+1)]);
+  DataMatrix shuffled(T.vertexData.size());
+  for (size_t k=0; k<perm.size(); ++k)
+    shuffled[perm[k]] = T.vertexData[k];
+  T.vertexData = shuffled;
+  for (size_t c=0; c<T.cellVertex.size(); ++c)
+    for (size_t k=0; k<6; ++k)
+      T.cellVertex[c][k] = perm[T.cellVertex[c][k]];
+  for (size_t w=0; w<T.wallVertex.size(); ++w)
+    for (size_t k=0; k<2; ++k)
+      T.wallVertex[w][k] = perm[T.wallVertex[w][k]];
+  if (shuffleCells)
+    for (size_t c=T.cellVertex.size()-1; c>0; --c) {
+      size_t c2 = std::rand()%(c+1);
+      T.cellVertex[c].swap(T.cellVertex[c2]);
+      T.cellWall[c].swap(T.cellWall[c2]);
+    }
+  return T;
+}
+
+// Polygon areas of all cells (the per-step volume sweep of the division flags)
+template<class Matrix>
+inline double volumeSweep(const HexTissue &T, const Matrix &vertexData)
+{
+  double sum = 0.0;
+  for (size_t c=0; c<T.cellVertex.size(); ++c) {
+    const std::vector<size_t> &v = T.cellVertex[c];
+    double area = 0.0;
+    for (size_t k=0; k<v.size(); ++k) {
+      size_t k1 = (k+1)%v.size();
+      area += vertexData[v[k]][0]*vertexData[v[k1]][1] - vertexData[v[k1]][0]*vertexData[v[k]][1];
+    }
+    sum += 0.5*std::fabs(area);
+  }
+  return sum;
+}
+
+// Wall pair loop of the shortest path search through the vertex mean of each cell
+template<class Matrix>
+inline double candidateSweep(const HexTissue &T, const Matrix &vertexData)
+{
+  double sum = 0.0;
+  for (size_t c=0; c<T.cellVertex.size(); ++c) {
+    const std::vector<size_t> &v = T.cellVertex[c];
+    const std::vector<size_t> &w = T.cellWall[c];
+    double ox = 0.0, oy = 0.0;
+    for (size_t k=0; k<v.size(); ++k) {
+      ox += vertexData[v[k]][0]/v.size();
+      oy += vertexData[v[k]][1]/v.size();
+    }
+    double best = 1e300;
+    for (size_t i=0; i<w.size()-1; ++i)
+      for (size_t j=i+1; j<w.size(); ++j) {
+	size_t a1 = T.wallVertex[w[i]][0], a2 = T.wallVertex[w[i]][1];
+	size_t b1 = T.wallVertex[w[j]][0], b2 = T.wallVertex[w[j]][1];
+	double vx = vertexData[a2][0]-vertexData[a1][0];
+	double vy = vertexData[a2][1]-vertexData[a1][1];
+	double ux = vertexData[b2][0]-vertexData[b1][0];
+	double uy = vertexData[b2][1]-vertexData[b1][1];
+	double t = ((ox-vertexData[a1][0])*vx + (oy-vertexData[a1][1])*vy)/(vx*vx+vy*vy);
+	double s = ((ox-vertexData[b1][0])*ux + (oy-vertexData[b1][1])*uy)/(ux*ux+uy*uy);
+	if (t <= 0.0 || t >= 1.0 || s <= 0.0 || s >= 1.0)
+	  continue;
+	double dx = vertexData[b1][0]+s*ux - vertexData[a1][0]-t*vx;
+	double dy = vertexData[b1][1]+s*uy - vertexData[a1][1]-t*vy;
+	best = std::min(best, std::sqrt(dx*dx+dy*dy));
+      }
+    sum += best;
+  }
+  return sum;
+}
+
+template<class Function>
+inline double timeMs(Function f, double &result, size_t numRepeat=20)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (size_t r=0; r<numRepeat; ++r)
+    result = f();
+  std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now()-start;
+  return t.count()/numRepeat;
+}
+
+#endif
@@ -0,0 +1,119 @@
+//
+// Filename     : renumberingBenchmark.cc
+// Description  : Effect of space-filling curve renumbering on tissue sweeps
+// Revision     : $Id:$
+//
+// Compile (from tissue_mod, with the Tissue src directory for the Tissue headers):
+//
+//   g++ -O2 -I. -I<tissue>/src benchmark/renumberingBenchmark.cc -o renumberingBenchmark
+//
+// Builds hexagonal tissues with 10k-100k cells where vertex indices and cell
+// order are shuffled (as after many divisions), and times the volume sweep and
+// the candidate wall pair loop before and after renumbering cells, walls and
+// vertices along the Hilbert curve. The wall locality (mean index distance of
+// the wall vertices over the number of vertices) is printed as a proxy for the
+// cache misses of the vertex gathers.
+//
+#include <cstdlib>
+#include <iostream>
+
+#include "hexTissue.h"
+#include "spaceFillingCurve.h"
+
+static double wallLocality(const HexTissue &T)
+{
+  double sum = 0.0;
+  for (size_t w=0; w<T.wallVertex.size(); ++w) {
+    size_t v1 = T.wallVertex[w][0], v2 = T.wallVertex[w][1];
+    sum += v1 > v2 ? v1-v2 : v2-v1;
+  }
+  return sum / (double(T.wallVertex.size()) * T.vertexData.size());
+}
+
+// Renumbers vertices and cells along the curve and walls by their first vertex, copying
+// all rows into storage allocated in the new order
+static void renumber(HexTissue &T)
+{
+  std::vector<size_t> vertexOrder = SpaceFillingCurve::curveOrder(T.vertexData);
+  std::vector<size_t> newVertex(vertexOrder.size());
+  for (size_t i=0; i<vertexOrder.size(); ++i)
+    newVertex[vertexOrder[i]] = i;
+  SpaceFillingCurve::permuteRows(T.vertexData, vertexOrder);
+  for (size_t c=0; c<T.cellVertex.size(); ++c)
+    for (size_t k=0; k<T.cellVertex[c].size(); ++k)
+      T.cellVertex[c][k] = newVertex[T.cellVertex[c][k]];
+  for (size_t w=0; w<T.wallVertex.size(); ++w)
+    for (size_t k=0; k<2; ++k)
+      T.wallVertex[w][k] = newVertex[T.wallVertex[w][k]];
+
+  DataMatrix center(T.cellVertex.size(), std::vector<double>(2));
+  for (size_t c=0; c<T.cellVertex.size(); ++c)
+    for (size_t k=0; k<T.cellVertex[c].size(); ++k)
+      for (size_t d=0; d<2; ++d)
+	center[c][d] += T.vertexData[T.cellVertex[c][k]][d] / T.cellVertex[c].size();
+  std::vector<size_t> cellOrder = SpaceFillingCurve::curveOrder(center);
+  std::vector< std::vector<size_t> > cellVertex(cellOrder.size()), cellWall(cellOrder.size());
+  for (size_t c=0; c<cellOrder.size(); ++c) {
+    cellVertex[c] = T.cellVertex[cellOrder[c]];
+    cellWall[c] = T.cellWall[cellOrder[c]];
+  }
+  T.cellVertex.swap(cellVertex);
+  T.cellWall.swap(cellWall);
+
+  std::vector< std::pair<size_t, size_t> > key(T.wallVertex.size());
+  for (size_t w=0; w<key.size(); ++w) {
+    key[w].first = std::min(T.wallVertex[w][0], T.wallVertex[w][1]);
+    key[w].second = w;
+  }
+  std::sort(key.begin(), key.end());
+  std::vector<size_t> newWall(key.size());
+  std::vector< std::vector<size_t> > wallVertex(key.size());
+  for (size_t w=0; w<key.size(); ++w) {
+    newWall[key[w].second] = w;
+    wallVertex[w] = T.wallVertex[key[w].second];
+  }
+  T.wallVertex.swap(wallVertex);
+  for (size_t c=0; c<T.cellWall.size(); ++c)
+    for (size_t k=0; k<T.cellWall[c].size(); ++k)
+      T.cellWall[c][k] = newWall[T.cellWall[c][k]];
+}
+
+template<class Matrix>
+struct VolumeSweep {
+  const HexTissue *T; const Matrix *m;
+  double operator()() const { return volumeSweep(*T, *m); }
+};
+
+template<class Matrix>
+struct CandidateSweep {
+  const HexTissue *T; const Matrix *m;
+  double operator()() const { return candidateSweep(*T, *m); }
+};
+
+int main()
+{
+  size_t sizes[3] = {100, 173, 317}; // 10k, 30k and 100k cells
+  std::cout << "numCell locality(before) locality(after) volume(before) volume(after) "
+	    << "candidates(before) candidates(after) renumber [ms]" << std::endl;
+  for (size_t k=0; k<3; ++k) {
+    HexTissue T = hexTissue(sizes[k], sizes[k], true);
+    double l1 = wallLocality(T), r1, r2, r3, r4;
+    VolumeSweep<DataMatrix> v1 = {&T, &T.vertexData};
+    CandidateSweep<DataMatrix> c1 = {&T, &T.vertexData};
+    double t1 = timeMs(v1, r1), t3 = timeMs(c1, r3);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    renumber(T);
+    std::chrono::duration<double, std::milli> tr = std::chrono::steady_clock::now()-start;
+
+    double l2 = wallLocality(T);
+    double t2 = timeMs(v1, r2), t4 = timeMs(c1, r4);
+    if (std::fabs(r1-r2) > 1e-6*std::fabs(r1) || std::fabs(r3-r4) > 1e-6*std::fabs(r3)) {
+      std::cerr << "renumberingBenchmark: results differ" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << T.cellVertex.size() << " " << l1 << " " << l2 << " " << t1 << " " << t2
+	      << " " << t3 << " " << t4 << " " << tr.count() << std::endl;
+  }
+  return 0;
+}
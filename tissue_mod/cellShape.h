@@ -0,0 +1,294 @@
+//
+// Filename     : cellShape.h
+// Description  : Per-cell shape tensors (vertex covariance, main axis, anisotropy)
+// Revision     : $Id:$
+//
+#ifndef CELLSHAPE_H
+#define CELLSHAPE_H
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include "tissue.h"
+
+///
+/// @brief Namespace for the per-cell shape tensor of the vertex positions.
+///
+/// The shape tensor of a cell is the covariance of its vertex positions. Its largest
+/// eigenvector is the main axis of the cell (as used by Division::MainAxis), and the two
+/// largest eigenvalues give the anisotropy @f$(\lambda_1-\lambda_2)/(\lambda_1+\lambda_2)@f$
+/// and the elongation @f$\sqrt{\lambda_1/\lambda_2}@f$. Eigenproblems are solved in closed
+/// form for 2D and 3D, and nothing is allocated per cell.
+///
+namespace CellShape {
+
+  ///
+  /// @brief Closed form eigen decomposition of a symmetric 2x2 matrix [a b; b c].
+  ///
+  /// Eigenvalues are returned in descending order, together with the (normalized)
+  /// eigenvector of the largest one.
+  ///
+  inline void symmetricEigen2(double a, double b, double c, double lambda[2], double axis[2])
+  {
+    double mean = 0.5*(a+c);
+    double r = std::sqrt(0.25*(a-c)*(a-c) + b*b);
+    lambda[0] = mean + r;
+    lambda[1] = mean - r;
+    if (b != 0.0) {
+      axis[0] = lambda[0]-c;
+      axis[1] = b;
+      double norm = std::sqrt(axis[0]*axis[0] + axis[1]*axis[1]);
+      axis[0] /= norm;
+      axis[1] /= norm;
+    }
+    else {
+      axis[0] = a >= c ? 1.0 : 0.0;
+      axis[1] = a >= c ? 0.0 : 1.0;
+    }
+  }
+
+  ///
+  /// @brief Closed form eigen decomposition of a symmetric 3x3 matrix.
+  ///
+  /// The matrix is given by its upper triangle (a00, a01, a02, a11, a12, a22). Eigenvalues
+  /// are found with the trigonometric solution of the characteristic polynomial and returned
+  /// in descending order, and the eigenvector of the largest one from cross products of the
+  /// rows of @f$A-\lambda_1 I@f$.
+  ///
+  inline void symmetricEigen3(const double A[6], double lambda[3], double axis[3])
+  {
+    double p1 = A[1]*A[1] + A[2]*A[2] + A[4]*A[4];
+    if (p1 == 0.0) {
+      // Diagonal matrix
+      double d[3] = {A[0], A[3], A[5]};
+      size_t order[3] = {0, 1, 2};
+      for (size_t k=0; k<2; ++k)
+	for (size_t l=k+1; l<3; ++l)
+	  if (d[order[l]] > d[order[k]]) {
+	    size_t tmp = order[k];
+	    order[k] = order[l];
+	    order[l] = tmp;
+	  }
+      for (size_t k=0; k<3; ++k) {
+	lambda[k] = d[order[k]];
+	axis[k] = k == order[0] ? 1.0 : 0.0;
+      }
+      return;
+    }
+    double q = (A[0]+A[3]+A[5])/3.0;
+    double p2 = (A[0]-q)*(A[0]-q) + (A[3]-q)*(A[3]-q) + (A[5]-q)*(A[5]-q) + 2.0*p1;
+    double p = std::sqrt(p2/6.0);
+    double b00 = (A[0]-q)/p, b11 = (A[3]-q)/p, b22 = (A[5]-q)/p;
+    double b01 = A[1]/p, b02 = A[2]/p, b12 = A[4]/p;
+    double r = 0.5*(b00*(b11*b22-b12*b12) - b01*(b01*b22-b12*b02) + b02*(b01*b12-b11*b02));
+    r = r < -1.0 ? -1.0 : (r > 1.0 ? 1.0 : r);
+    double phi = std::acos(r)/3.0;
+    const double pi = 3.141592653589793;
+    lambda[0] = q + 2.0*p*std::cos(phi);
+    lambda[2] = q + 2.0*p*std::cos(phi + 2.0*pi/3.0);
+    lambda[1] = 3.0*q - lambda[0] - lambda[2];
+
+    // Eigenvector of lambda[0] from the rows of A-lambda[0]I
+    double row[3][3] = {{A[0]-lambda[0], A[1], A[2]},
+			{A[1], A[3]-lambda[0], A[4]},
+			{A[2], A[4], A[5]-lambda[0]}};
+    double best = 0.0;
+    for (size_t k=0; k<2; ++k)
+      for (size_t l=k+1; l<3; ++l) {
+	double c[3] = {row[k][1]*row[l][2] - row[k][2]*row[l][1],
+		       row[k][2]*row[l][0] - row[k][0]*row[l][2],
+		       row[k][0]*row[l][1] - row[k][1]*row[l][0]};
+	double norm = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+	if (norm > best) {
+	  best = norm;
+	  axis[0] = c[0];
+	  axis[1] = c[1];
+	  axis[2] = c[2];
+	}
+      }
+    if (best > 0.0) {
+      best = std::sqrt(best);
+      axis[0] /= best;
+      axis[1] /= best;
+      axis[2] /= best;
+      return;
+    }
+    // lambda[0] is degenerate (A-lambda[0]I has rank <= 1), any vector
+    // perpendicular to its largest row is an eigenvector
+    size_t k = 0;
+    for (size_t l=1; l<3; ++l)
+      if (row[l][0]*row[l][0] + row[l][1]*row[l][1] + row[l][2]*row[l][2] >
+	  row[k][0]*row[k][0] + row[k][1]*row[k][1] + row[k][2]*row[k][2])
+	k = l;
+    double e[3] = {0.0, 0.0, 0.0};
+    e[std::abs(row[k][0]) <= std::abs(row[k][1]) ?
+      (std::abs(row[k][0]) <= std::abs(row[k][2]) ? 0 : 2) :
+      (std::abs(row[k][1]) <= std::abs(row[k][2]) ? 1 : 2)] = 1.0;
+    axis[0] = row[k][1]*e[2] - row[k][2]*e[1];
+    axis[1] = row[k][2]*e[0] - row[k][0]*e[2];
+    axis[2] = row[k][0]*e[1] - row[k][1]*e[0];
+    double norm = std::sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+    if (norm > 0.0) {
+      axis[0] /= norm;
+      axis[1] /= norm;
+      axis[2] /= norm;
+    }
+    else {
+      axis[0] = 1.0;
+      axis[1] = axis[2] = 0.0;
+    }
+  }
+
+  ///
+  /// @brief Covariance (upper triangle) of the vertex positions of a cell.
+  ///
+  /// For dimension 2 only cov[0], cov[1] and cov[3] are set.
+  ///
+  template<class Matrix>
+  inline void covariance(Cell &cell, const Matrix &vertexData, size_t dimension,
+			 double cov[6])
+  {
+    size_t numV = cell.numVertex();
+    double mean[3] = {0.0, 0.0, 0.0};
+    for (size_t k=0; k<numV; ++k) {
+      size_t vI = cell.vertex(k)->index();
+      for (size_t d=0; d<dimension; ++d)
+	mean[d] += vertexData[vI][d];
+    }
+    for (size_t d=0; d<dimension; ++d)
+      mean[d] /= numV;
+    for (size_t k=0; k<6; ++k)
+      cov[k] = 0.0;
+    for (size_t k=0; k<numV; ++k) {
+      size_t vI = cell.vertex(k)->index();
+      double dx = vertexData[vI][0]-mean[0];
+      double dy = vertexData[vI][1]-mean[1];
+      double dz = dimension == 3 ? vertexData[vI][2]-mean[2] : 0.0;
+      cov[0] += dx*dx;
+      cov[1] += dx*dy;
+      cov[2] += dx*dz;
+      cov[3] += dy*dy;
+      cov[4] += dy*dz;
+      cov[5] += dz*dz;
+    }
+    for (size_t k=0; k<6; ++k)
+      cov[k] /= numV;
+  }
+
+  ///
+  /// @brief Eigenvalues (descending) and main axis of the shape tensor of one cell.
+  ///
+  template<class Matrix>
+  inline void shape(Cell &cell, const Matrix &vertexData, size_t dimension,
+		    double cov[6], double lambda[3], double axis[3])
+  {
+    covariance(cell, vertexData, dimension, cov);
+    if (dimension == 2) {
+      symmetricEigen2(cov[0], cov[1], cov[3], lambda, axis);
+      lambda[2] = axis[2] = 0.0;
+    }
+    else
+      symmetricEigen3(cov, lambda, axis);
+  }
+
+  ///
+  /// @brief Main axis (largest eigenvector of the shape tensor) of a cell.
+  ///
+  template<class Matrix>
+  inline std::vector<double> mainAxis(Cell &cell, const Matrix &vertexData)
+  {
+    size_t dimension = vertexData[0].size();
+    double cov[6], lambda[3], axis[3];
+    shape(cell, vertexData, dimension, cov, lambda, axis);
+    return std::vector<double>(axis, axis+dimension);
+  }
+
+  ///
+  /// @brief Shape tensors of all cells of a tissue, stored as one array per quantity.
+  ///
+  /// The cells are computed one at a time by shape(). Written as per-cell features for
+  /// morphology analysis by print(), e.g. by benchmark/cellShapeFeatures.cc from an init file:
+  ///
+  /// @verbatim
+  /// cell lambda1 lambda2 lambda3 axisX axisY axisZ anisotropy elongation
+  /// @endverbatim
+  ///
+  class ShapeTensors {
+  public:
+    ShapeTensors() : dimension_(0) {}
+
+    ///
+    /// @brief Computes the shape tensors of all cells.
+    ///
+    template<class Matrix>
+    void compute(Tissue &T, const Matrix &vertexData)
+    {
+      size_t numCell = T.numCell();
+      dimension_ = vertexData.size() ? vertexData[0].size() : 0;
+      for (size_t k=0; k<6; ++k)
+	cov_[k].resize(numCell);
+      for (size_t k=0; k<3; ++k) {
+	lambda_[k].resize(numCell);
+	axis_[k].resize(numCell);
+      }
+      for (size_t i=0; i<numCell; ++i) {
+	double cov[6], lambda[3], axis[3];
+	shape(T.cell(i), vertexData, dimension_, cov, lambda, axis);
+	for (size_t k=0; k<6; ++k)
+	  cov_[k][i] = cov[k];
+	for (size_t k=0; k<3; ++k) {
+	  lambda_[k][i] = lambda[k];
+	  axis_[k][i] = axis[k];
+	}
+      }
+    }
+
+    size_t numCell() const { return lambda_[0].size(); }
+    size_t dimension() const { return dimension_; }
+
+    /// @brief Covariance component k (upper triangle: xx, xy, xz, yy, yz, zz) of all cells.
+    const std::vector<double>& covariance(size_t k) const { return cov_[k]; }
+    /// @brief Eigenvalue k (descending order) of all cells.
+    const std::vector<double>& lambda(size_t k) const { return lambda_[k]; }
+    /// @brief Component d of the main axis of all cells.
+    const std::vector<double>& axis(size_t d) const { return axis_[d]; }
+
+    double anisotropy(size_t i) const
+    {
+      double sum = lambda_[0][i] + lambda_[1][i];
+      return sum > 0.0 ? (lambda_[0][i]-lambda_[1][i])/sum : 0.0;
+    }
+
+    double elongation(size_t i) const
+    {
+      return lambda_[1][i] > 0.0 ? std::sqrt(lambda_[0][i]/lambda_[1][i]) :
+	std::numeric_limits<double>::infinity();
+    }
+
+    ///
+    /// @brief Writes one row of shape features per cell.
+    ///
+    void print(std::ostream &os) const
+    {
+      for (size_t i=0; i<numCell(); ++i) {
+	os << i;
+	for (size_t k=0; k<3; ++k)
+	  os << " " << lambda_[k][i];
+	for (size_t d=0; d<3; ++d)
+	  os << " " << axis_[d][i];
+	os << " " << anisotropy(i) << " " << elongation(i) << std::endl;
+      }
+    }
+
+  private:
+    size_t dimension_;
+    std::vector<double> cov_[6];
+    std::vector<double> lambda_[3];
+    std::vector<double> axis_[3];
+  };
+
+} //end namespace CellShape
+
+#endif
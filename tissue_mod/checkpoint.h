@@ -0,0 +1,553 @@
+//
+// Filename     : checkpoint.h
+// Description  : Binary checkpoint/restart of the simulation state
+// Revision     : $Id:$
+//
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "tissue.h"
+#include "baseCompartmentChange.h"
+#include "myRandom.h"
+
+///
+/// @brief Byte buffer for the sections of a checkpoint, written and read sequentially.
+///
+class CheckpointBuffer {
+
+ public:
+
+  CheckpointBuffer() : pos_(0) {}
+
+  template<class T>
+  void put(const T &value) { putBytes(&value, sizeof(T)); }
+
+  template<class T>
+  void put(const std::vector<T> &value) {
+    put(static_cast<unsigned long long>(value.size()));
+    if (value.size())
+      putBytes(&value[0], value.size()*sizeof(T));
+  }
+
+  template<class T>
+  void get(T &value) { getBytes(&value, sizeof(T)); }
+
+  template<class T>
+  void get(std::vector<T> &value) {
+    unsigned long long n;
+    get(n);
+    value.resize(n);
+    if (n)
+      getBytes(&value[0], n*sizeof(T));
+  }
+
+  void putBytes(const void *p, size_t n) {
+    const char *c = static_cast<const char*>(p);
+    data_.insert(data_.end(), c, c+n);
+  }
+
+  void getBytes(void *p, size_t n) {
+    if (pos_+n > data_.size()) {
+      std::cerr << "CheckpointBuffer::getBytes() "
+		<< "Reading past the end of a checkpoint section." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::memcpy(p, &data_[pos_], n);
+    pos_ += n;
+  }
+
+  std::vector<char>& data() { return data_; }
+  const std::vector<char>& data() const { return data_; }
+
+ private:
+
+  std::vector<char> data_;
+  size_t pos_;
+};
+
+///
+/// @brief Internal state (of a rule or a solver) to be saved in checkpoints.
+///
+/// Objects register themselves with Checkpoint::instance().add() and are removed from the
+/// checkpoint when destroyed.
+///
+class CheckpointState {
+
+ public:
+
+  virtual ~CheckpointState();
+
+  virtual void writeState(CheckpointBuffer &buffer) const = 0;
+  virtual void readState(CheckpointBuffer &buffer) = 0;
+};
+
+///
+/// @brief Compact binary checkpoint of the tissue topology, the data and derivative
+/// matrices, registered internal states, and the random number generators.
+///
+/// The file is a header (magic, version, number of sections), a table of named sections
+/// (name, offset, size), and the sections, 8 byte aligned. Matrices are stored as the number
+/// of rows, the row lengths and the values, such that they can be read directly or mapped.
+/// Files are written to a temporary file that is synced and renamed, so a run killed while
+/// writing keeps the previous checkpoint.
+///
+/// Checkpoints are written at solver step boundaries: the solver checks the compartment
+/// changes once per step, and a step is counted when the first rule checked starts a new
+/// sweep over the cells (visit(), called by ObservedCompartmentChange::flag()), i.e. after
+/// the solver step and before any compartment change of the step. The solver state is the
+/// data matrices, stored together with the number of steps; the solver time and step size
+/// are held by the solver and not stored. Runs without compartment change rules add the
+/// rule Checkpoint (no parameters, no changes) to the model file to be checkpointed.
+///
+/// The state of rand() is copied from the C library (initstate()/setstate(), for the
+/// default 128 byte state of glibc) without changing the sequence. The state of
+/// myRandom::Rnd() is held inside myRandom.cc and not accessible, so it is reseeded from its
+/// own stream at each checkpoint and the seed is stored; since checkpoints are due after a
+/// number of steps, a run continuing from a checkpoint is identical to the run that wrote
+/// it, but differs from a run with the same seed written without checkpoints.
+///
+/// Checkpointing is switched on by the environment variable TISSUE_CHECKPOINT (file name),
+/// and a checkpoint is written every TISSUE_CHECKPOINT_INTERVAL steps (default 100), with
+/// the tissue written as an init file next to it (file name + .init). To restart, the
+/// simulator is run with that init file and TISSUE_RESTART set to the checkpoint: at the
+/// first step the topology is checked against the checkpoint, and the data matrices (at
+/// full precision), rule states, generators and step count are read back. The solver start
+/// time is to be set in the solver file.
+///
+class Checkpoint {
+
+ public:
+
+  struct Topology {
+    size_t numCell, numWall, numVertex;
+    std::vector<long long> wall;        ///< cell1 cell2 vertex1 vertex2 per wall
+    std::vector<size_t> cellWallStart;  ///< cellWall[cellWallStart[i]..cellWallStart[i+1]]
+    std::vector<size_t> cellWall;
+    std::vector<size_t> cellVertexStart;
+    std::vector<size_t> cellVertex;
+  };
+
+  static Checkpoint& instance() {
+    static Checkpoint checkpoint;
+    return checkpoint;
+  }
+
+  ///
+  /// @brief Registers a state, saved under the name (numbered if used several times).
+  ///
+  void add(const std::string &name, CheckpointState *state) {
+    size_t n = 0;
+    for (size_t k=0; k<stateName_.size(); ++k)
+      if (stateName_[k].compare(0, name.size()+1, name+"#") == 0)
+	++n;
+    stateName_.push_back(name + "#" + std::to_string(n));
+    state_.push_back(state);
+  }
+
+  void remove(CheckpointState *state) {
+    for (size_t k=0; k<state_.size(); ++k)
+      if (state_[k] == state) {
+	state_.erase(state_.begin()+k);
+	stateName_.erase(stateName_.begin()+k);
+	return;
+      }
+  }
+
+  ///
+  /// @brief Returns 1 if checkpointing is switched on.
+  ///
+  int enabled() const { return !fileName_.empty(); }
+
+  ///
+  /// @brief Counts a step when rule starts a new sweep over the cells (i at most the cell
+  /// previously checked), restarting from TISSUE_RESTART at the first step and writing a
+  /// checkpoint when due. To be called first when rule checks cell i.
+  ///
+  void visit(const void *rule, Tissue &T, size_t i,
+	     DataMatrix &cellData, DataMatrix &wallData, DataMatrix &vertexData,
+	     DataMatrix &cellDerivs, DataMatrix &wallDerivs, DataMatrix &vertexDerivs) {
+    if (!stepRule_)
+      stepRule_ = rule;
+    if (rule != stepRule_)
+      return;
+    int newStep = lastCell_ == none || i <= lastCell_;
+    lastCell_ = i;
+    if (!newStep)
+      return;
+    if (numStep_ == 0 && !restarted_) {
+      restarted_ = 1;
+      const char *fileName = std::getenv("TISSUE_RESTART");
+      if (fileName && *fileName) {
+	restart(fileName, T, cellData, wallData, vertexData, cellDerivs, wallDerivs,
+		vertexDerivs);
+	return;
+      }
+    }
+    ++numStep_;
+    if (enabled() && numStep_ % interval_ == 0)
+      write(fileName_, T, cellData, wallData, vertexData, cellDerivs, wallDerivs,
+	    vertexDerivs);
+  }
+
+  ///
+  /// @brief Number of solver steps counted, including those before a restart.
+  ///
+  size_t numStep() const { return numStep_; }
+
+  ///
+  /// @brief Writes a checkpoint, and the tissue as an init file (fileName + .init).
+  ///
+  void write(const std::string &fileName, Tissue &T,
+	     DataMatrix &cellData, DataMatrix &wallData,
+	     DataMatrix &vertexData, const DataMatrix &cellDerivs,
+	     const DataMatrix &wallDerivs, const DataMatrix &vertexDerivs) {
+    std::vector< std::pair<std::string, CheckpointBuffer> > section;
+
+    section.push_back(std::make_pair(std::string("topology"), CheckpointBuffer()));
+    writeTopology(T, section.back().second);
+
+    const DataMatrix *matrix[6] = {&cellData, &wallData, &vertexData,
+				   &cellDerivs, &wallDerivs, &vertexDerivs};
+    for (size_t m=0; m<6; ++m) {
+      section.push_back(std::make_pair(std::string(matrixName(m)), CheckpointBuffer()));
+      writeMatrix(*matrix[m], section.back().second);
+    }
+
+    // myRandom is reseeded from its own stream, the state of rand() is copied
+    long rndSeed = 1 + long(myRandom::Rnd()*2147483645.0);
+    myRandom::sran3(rndSeed);
+    section.push_back(std::make_pair(std::string("rng"), CheckpointBuffer()));
+    section.back().second.put(static_cast<long long>(rndSeed));
+    section.back().second.putBytes(randState(), randStateSize);
+    section.back().second.put(static_cast<unsigned long long>(numStep_));
+
+    for (size_t k=0; k<state_.size(); ++k) {
+      section.push_back(std::make_pair("state:" + stateName_[k], CheckpointBuffer()));
+      state_[k]->writeState(section.back().second);
+    }
+
+    std::string tmpName = fileName + ".tmp";
+    std::FILE *f = std::fopen(tmpName.c_str(), "wb");
+    if (!f) {
+      std::cerr << "Checkpoint::write() Cannot open file " << tmpName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    unsigned long long numSection = section.size();
+    unsigned long long offset = headerSize + numSection*entrySize;
+    unsigned long long fileVersion = version;
+    int ok = std::fwrite(magic(), 1, 8, f) == 8;
+    ok = ok && std::fwrite(&fileVersion, sizeof(fileVersion), 1, f) == 1;
+    ok = ok && std::fwrite(&numSection, sizeof(numSection), 1, f) == 1;
+    for (size_t k=0; k<section.size(); ++k) {
+      char name[nameSize];
+      std::memset(name, 0, nameSize);
+      std::strncpy(name, section[k].first.c_str(), nameSize-1);
+      unsigned long long size = section[k].second.data().size();
+      ok = ok && std::fwrite(name, 1, nameSize, f) == nameSize;
+      ok = ok && std::fwrite(&offset, sizeof(offset), 1, f) == 1;
+      ok = ok && std::fwrite(&size, sizeof(size), 1, f) == 1;
+      offset += align(size);
+    }
+    const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (size_t k=0; k<section.size(); ++k) {
+      const std::vector<char> &data = section[k].second.data();
+      if (data.size())
+	ok = ok && std::fwrite(&data[0], 1, data.size(), f) == data.size();
+      size_t numPad = align(data.size()) - data.size();
+      ok = ok && std::fwrite(padding, 1, numPad, f) == numPad;
+    }
+    ok = ok && std::fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmpName.c_str(), fileName.c_str()) != 0) {
+      std::cerr << "Checkpoint::write() Failed writing " << fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    std::string initName = fileName + ".init";
+    std::ofstream init((initName + ".tmp").c_str());
+    T.printInit(cellData, wallData, vertexData, init);
+    init.close();
+    if (!init || std::rename((initName + ".tmp").c_str(), initName.c_str()) != 0) {
+      std::cerr << "Checkpoint::write() Failed writing " << initName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ///
+  /// @brief Reads a checkpoint into a tissue read from the init file written with it,
+  /// exiting if the topology differs.
+  ///
+  void restart(const std::string &fileName, Tissue &T,
+	       DataMatrix &cellData, DataMatrix &wallData, DataMatrix &vertexData,
+	       DataMatrix &cellDerivs, DataMatrix &wallDerivs, DataMatrix &vertexDerivs) {
+    Topology topology;
+    read(fileName, topology, cellData, wallData, vertexData, cellDerivs, wallDerivs,
+	 vertexDerivs);
+    CheckpointBuffer current;
+    writeTopology(T, current);
+    Topology tissue;
+    readTopology(current, tissue);
+    if (tissue.numCell != topology.numCell || tissue.numWall != topology.numWall ||
+	tissue.numVertex != topology.numVertex || tissue.wall != topology.wall) {
+      std::cerr << "Checkpoint::restart() The tissue does not match the topology in "
+		<< fileName << "; start from " << fileName << ".init" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::cerr << "Checkpoint::restart() Continuing from step " << numStep_ << " of "
+	      << fileName << std::endl;
+  }
+
+  ///
+  /// @brief Reads a checkpoint, setting the matrices, the registered states and the random
+  /// number generators, and returning the topology for the tissue to rebuild.
+  ///
+  void read(const std::string &fileName, Topology &topology,
+	    DataMatrix &cellData, DataMatrix &wallData, DataMatrix &vertexData,
+	    DataMatrix &cellDerivs, DataMatrix &wallDerivs, DataMatrix &vertexDerivs) {
+    std::vector< std::pair<std::string, CheckpointBuffer> > section;
+    readSections(fileName, section);
+
+    readTopology(find(section, "topology", fileName), topology);
+    DataMatrix *matrix[6] = {&cellData, &wallData, &vertexData,
+			     &cellDerivs, &wallDerivs, &vertexDerivs};
+    for (size_t m=0; m<6; ++m)
+      readMatrix(find(section, matrixName(m), fileName), *matrix[m]);
+
+    CheckpointBuffer &rng = find(section, "rng", fileName);
+    long long rndSeed;
+    unsigned long long numStep;
+    rng.get(rndSeed);
+    myRandom::sran3(long(rndSeed));
+    static char randState[randStateSize];
+    rng.getBytes(randState, randStateSize);
+    setstate(randState);
+    rng.get(numStep);
+    numStep_ = numStep;
+
+    for (size_t k=0; k<state_.size(); ++k)
+      state_[k]->readState(find(section, "state:" + stateName_[k], fileName));
+  }
+
+ private:
+
+  static const size_t nameSize = 32;
+  static const size_t headerSize = 24;
+  static const size_t entrySize = nameSize + 16;
+  static const unsigned long long version = 2;
+  static const size_t randStateSize = 128;
+  static const size_t none = static_cast<size_t>(-1);
+
+  static const char* magic() { return "TISSCKPT"; }
+
+  Checkpoint()
+    : interval_(100), numStep_(0), stepRule_(0), lastCell_(none), restarted_(0) {
+    const char *fileName = std::getenv("TISSUE_CHECKPOINT");
+    if (fileName)
+      fileName_ = fileName;
+    const char *interval = std::getenv("TISSUE_CHECKPOINT_INTERVAL");
+    if (interval && *interval)
+      interval_ = std::max(std::atol(interval), 1L);
+  }
+
+  ///
+  /// @brief Current state of rand(), left unchanged: initstate() switches to a scratch
+  /// state and returns the current one, which setstate() switches back to.
+  ///
+  static const char* randState() {
+    static char scratch[randStateSize], state[randStateSize];
+    char *current = initstate(1, scratch, randStateSize);
+    std::memcpy(state, current, randStateSize);
+    setstate(current);
+    return state;
+  }
+
+  static size_t align(size_t n) { return (n+7) & ~size_t(7); }
+
+  static const char* matrixName(size_t m) {
+    static const char *name[6] = {"cellData", "wallData", "vertexData",
+				  "cellDerivs", "wallDerivs", "vertexDerivs"};
+    return name[m];
+  }
+
+  static void writeTopology(Tissue &T, CheckpointBuffer &buffer) {
+    buffer.put(static_cast<unsigned long long>(T.numCell()));
+    buffer.put(static_cast<unsigned long long>(T.numWall()));
+    buffer.put(static_cast<unsigned long long>(T.numVertex()));
+    std::vector<long long> wall(4*T.numWall());
+    for (size_t w=0; w<T.numWall(); ++w) {
+      Wall &wa = T.wall(w);
+      wall[4*w] = wa.cell1() == T.background() ? -1 : (long long)(wa.cell1()->index());
+      wall[4*w+1] = wa.cell2() == T.background() ? -1 : (long long)(wa.cell2()->index());
+      wall[4*w+2] = wa.vertex1()->index();
+      wall[4*w+3] = wa.vertex2()->index();
+    }
+    buffer.put(wall);
+    std::vector<size_t> wallStart(1, 0), cellWall, vertexStart(1, 0), cellVertex;
+    for (size_t i=0; i<T.numCell(); ++i) {
+      Cell &cell = T.cell(i);
+      for (size_t k=0; k<cell.numWall(); ++k)
+	cellWall.push_back(cell.wall(k)->index());
+      for (size_t k=0; k<cell.numVertex(); ++k)
+	cellVertex.push_back(cell.vertex(k)->index());
+      wallStart.push_back(cellWall.size());
+      vertexStart.push_back(cellVertex.size());
+    }
+    buffer.put(wallStart);
+    buffer.put(cellWall);
+    buffer.put(vertexStart);
+    buffer.put(cellVertex);
+  }
+
+  static void readTopology(CheckpointBuffer &buffer, Topology &topology) {
+    unsigned long long n[3];
+    for (size_t k=0; k<3; ++k)
+      buffer.get(n[k]);
+    topology.numCell = n[0];
+    topology.numWall = n[1];
+    topology.numVertex = n[2];
+    buffer.get(topology.wall);
+    buffer.get(topology.cellWallStart);
+    buffer.get(topology.cellWall);
+    buffer.get(topology.cellVertexStart);
+    buffer.get(topology.cellVertex);
+  }
+
+  static void writeMatrix(const DataMatrix &matrix, CheckpointBuffer &buffer) {
+    std::vector<unsigned long long> rowSize(matrix.size());
+    for (size_t i=0; i<matrix.size(); ++i)
+      rowSize[i] = matrix[i].size();
+    buffer.put(rowSize);
+    for (size_t i=0; i<matrix.size(); ++i)
+      if (matrix[i].size())
+	buffer.putBytes(&matrix[i][0], matrix[i].size()*sizeof(double));
+  }
+
+  static void readMatrix(CheckpointBuffer &buffer, DataMatrix &matrix) {
+    std::vector<unsigned long long> rowSize;
+    buffer.get(rowSize);
+    matrix.resize(rowSize.size());
+    for (size_t i=0; i<matrix.size(); ++i) {
+      matrix[i].resize(rowSize[i]);
+      if (rowSize[i])
+	buffer.getBytes(&matrix[i][0], rowSize[i]*sizeof(double));
+    }
+  }
+
+  static void readSections(const std::string &fileName,
+			   std::vector< std::pair<std::string, CheckpointBuffer> > &section) {
+    std::FILE *f = std::fopen(fileName.c_str(), "rb");
+    if (!f) {
+      std::cerr << "Checkpoint::read() Cannot open file " << fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::vector<char> data;
+    char chunk[65536];
+    size_t n;
+    while ((n = std::fread(chunk, 1, sizeof(chunk), f)) > 0)
+      data.insert(data.end(), chunk, chunk+n);
+    std::fclose(f);
+
+    unsigned long long fileVersion, numSection;
+    if (data.size() < headerSize || std::memcmp(&data[0], magic(), 8) != 0) {
+      std::cerr << "Checkpoint::read() " << fileName << " is not a checkpoint file." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::memcpy(&fileVersion, &data[8], 8);
+    std::memcpy(&numSection, &data[16], 8);
+    if (fileVersion != version || data.size() < headerSize + numSection*entrySize) {
+      std::cerr << "Checkpoint::read() Unsupported or truncated checkpoint file "
+		<< fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    section.resize(numSection);
+    for (size_t k=0; k<numSection; ++k) {
+      const char *entry = &data[headerSize + k*entrySize];
+      unsigned long long offset, size;
+      std::memcpy(&offset, entry+nameSize, 8);
+      std::memcpy(&size, entry+nameSize+8, 8);
+      if (offset+size > data.size()) {
+	std::cerr << "Checkpoint::read() Truncated checkpoint file " << fileName << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      section[k].first.assign(entry, strnlen(entry, nameSize));
+      section[k].second.putBytes(&data[offset], size);
+    }
+  }
+
+  static CheckpointBuffer& find(std::vector< std::pair<std::string, CheckpointBuffer> > &section,
+				const std::string &name, const std::string &fileName) {
+    for (size_t k=0; k<section.size(); ++k)
+      if (section[k].first == name)
+	return section[k].second;
+    std::cerr << "Checkpoint::read() No section " << name << " in " << fileName << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  std::string fileName_;
+  size_t interval_;
+  size_t numStep_;
+  const void *stepRule_;
+  size_t lastCell_;
+  int restarted_;
+  std::vector<std::string> stateName_;
+  std::vector<CheckpointState*> state_;
+};
+
+inline CheckpointState::~CheckpointState() { Checkpoint::instance().remove(this); }
+
+///
+/// @brief Compartment change rule without changes, for checkpointing runs without other
+/// compartment change rules (the step is counted by ObservedCompartmentChange).
+///
+/// In a model file:
+/// @verbatim
+/// Checkpoint 0 0
+/// @endverbatim
+///
+class CheckpointStep : public BaseCompartmentChange {
+
+ public:
+
+  CheckpointStep(std::vector<double> &paraValue,
+		 std::vector< std::vector<size_t> > &indValue) {
+    if (paraValue.size() != 0 || indValue.size() != 0) {
+      std::cerr << "CheckpointStep::CheckpointStep() "
+		<< "No parameters and no variable indices are used." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    setId("Checkpoint");
+    setNumChange(0);
+    setParameter(paraValue);
+    setVariableIndex(indValue);
+  }
+
+  int flag(Tissue *T,size_t i,
+	   DataMatrix &cellData,
+	   DataMatrix &wallData,
+	   DataMatrix &vertexData,
+	   DataMatrix &cellDerivs,
+	   DataMatrix &wallDerivs,
+	   DataMatrix &vertexDerivs ) { return 0; }
+
+  void update(Tissue* T,size_t i,
+	      DataMatrix &cellData,
+	      DataMatrix &wallData,
+	      DataMatrix &vertexData,
+	      DataMatrix &cellDerivs,
+	      DataMatrix &wallDerivs,
+	      DataMatrix &vertexDerivs ) {}
+};
+
+#endif
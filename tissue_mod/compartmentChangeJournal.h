@@ -0,0 +1,149 @@
+//
+// Filename     : compartmentChangeJournal.h
+// Description  : Journal of topological changes by compartment change rules
+// Revision     : $Id:$
+//
+#ifndef COMPARTMENTCHANGEJOURNAL_H
+#define COMPARTMENTCHANGEJOURNAL_H
+
+#include <algorithm>
+#include <vector>
+
+#include "tissue.h"
+
+///
+/// @brief Journal of the cells, walls and vertices added or removed by compartment changes.
+///
+/// Every division/removal done by a compartment change rule (all observed by
+/// ObservedCompartmentChange) appends a
+/// compact record, such that solvers and observers can resize and update their own
+/// per-cell/wall/vertex state incrementally from the records added since they last looked,
+/// instead of comparing sizes. A division done by Tissue::divideCell() appends one cell, three
+/// walls (the new wall between the daughters first, as used by the division rules) and two
+/// vertices, and the two walls split by the new vertices keep their indices.
+///
+/// Records are only kept while consumers are registered (addConsumer()). Record numbers count
+/// all records appended, and the records all consumers have read (consumed()) are dropped.
+///
+class CompartmentChangeJournal {
+
+ public:
+
+  enum RecordType { division, removal, other };
+
+  static const size_t none = static_cast<size_t>(-1);
+
+  struct Record {
+    RecordType type;
+    size_t cell;            ///< updated cell (mother cell for divisions, keeps its index)
+    size_t newCell;         ///< daughter cell (divisions)
+    size_t newWall[3];      ///< new wall between daughters, and the two added wall pieces
+    size_t splitWall[2];    ///< walls split by the two new vertices
+    size_t newVertex[2];
+    size_t numCell, numWall, numVertex; ///< sizes after the change
+  };
+
+  static CompartmentChangeJournal& instance() {
+    static CompartmentChangeJournal journal;
+    return journal;
+  }
+
+  ///
+  /// @brief Registers a consumer reading the records from now on, and returns its number.
+  ///
+  size_t addConsumer() {
+    consumed_.push_back(numRecord());
+    return consumed_.size()-1;
+  }
+
+  size_t numConsumer() const { return consumed_.size(); }
+
+  ///
+  /// @brief Number of records appended so far, i.e. one past the last record.
+  ///
+  size_t numRecord() const { return firstRecord_+record_.size(); }
+
+  ///
+  /// @brief Record k, for firstRecord() <= k < numRecord().
+  ///
+  const Record& record(size_t k) const { return record_[k-firstRecord_]; }
+
+  size_t firstRecord() const { return firstRecord_; }
+
+  ///
+  /// @brief Marks the records before k as read by the consumer, and drops the records read
+  /// by all consumers.
+  ///
+  void consumed(size_t consumer, size_t k) {
+    consumed_[consumer] = k;
+    size_t read = *std::min_element(consumed_.begin(), consumed_.end());
+    if (read == numRecord()) {
+      record_.clear();
+      firstRecord_ = read;
+    }
+    else if (2*(read-firstRecord_) >= record_.size()) {
+      record_.erase(record_.begin(), record_.begin()+(read-firstRecord_));
+      firstRecord_ = read;
+    }
+  }
+
+  void beforeUpdate(Tissue *T) {
+    numCellOld_ = T->numCell();
+    numWallOld_ = T->numWall();
+    numVertexOld_ = T->numVertex();
+  }
+
+  ///
+  /// @brief Appends a record if the update of cell i changed the tissue topology and a
+  /// consumer is registered.
+  ///
+  void afterUpdate(Tissue *T, size_t i) {
+    if (T->numCell() == numCellOld_ && T->numWall() == numWallOld_ &&
+	T->numVertex() == numVertexOld_)
+      return;
+    if (consumed_.empty())
+      return;
+    Record r;
+    r.cell = i;
+    r.newCell = none;
+    r.newWall[0] = r.newWall[1] = r.newWall[2] = none;
+    r.splitWall[0] = r.splitWall[1] = none;
+    r.newVertex[0] = r.newVertex[1] = none;
+    r.numCell = T->numCell();
+    r.numWall = T->numWall();
+    r.numVertex = T->numVertex();
+
+    if (r.numCell == numCellOld_+1 && r.numWall == numWallOld_+3 &&
+	r.numVertex == numVertexOld_+2) {
+      r.type = division;
+      r.newCell = numCellOld_;
+      for (size_t k=0; k<3; ++k)
+	r.newWall[k] = numWallOld_+k;
+      for (size_t k=0; k<2; ++k) {
+	r.newVertex[k] = numVertexOld_+k;
+	Vertex &v = T->vertex(r.newVertex[k]);
+	for (size_t w=0; w<v.numWall(); ++w)
+	  if (v.wall(w)->index() < numWallOld_)
+	    r.splitWall[k] = v.wall(w)->index();
+      }
+    }
+    else if (r.numCell < numCellOld_)
+      r.type = removal;
+    else
+      r.type = other;
+    record_.push_back(r);
+  }
+
+ private:
+
+  CompartmentChangeJournal()
+    : firstRecord_(0), numCellOld_(0), numWallOld_(0),
+      numVertexOld_(0) {}
+
+  std::vector<Record> record_;
+  size_t firstRecord_;
+  std::vector<size_t> consumed_;
+  size_t numCellOld_, numWallOld_, numVertexOld_;
+};
+
+#endif
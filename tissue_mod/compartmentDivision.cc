@@ -8,7 +8,9 @@
 #include <limits>
 
 #include "baseCompartmentChange.h"
+#include "cellShape.h"
 #include "compartmentDivision.h"
+#include "compartmentProfile.h"
 #include "myMath.h"
 #include "myRandom.h"
 
@@ -119,9 +121,11 @@ namespace Division {
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
 		  cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -828,9 +832,11 @@ namespace Division {
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
 		  cellDeriv, wallDeriv, vertexDeriv, variableIndex(1),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -1031,9 +1037,11 @@ namespace Division {
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
 		  cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -1235,9 +1243,11 @@ namespace Division {
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
       cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
       parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -1448,9 +1458,11 @@ void VolumeViaLongestWall3DSpatial::update(
   size_t numWallTmp = wallData.size();
   assert(numWallTmp == T->numWall());
   // Divide
+  CompartmentProfile::startDivideCell();
   T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
                 cellDeriv, wallDeriv, vertexDeriv, variableIndex(1),
                 parameter(2));
+  CompartmentProfile::stopDivideCell();
   assert(numWallTmp + 3 == T->numWall());
 
   // Change length of new wall between the divided daugther cells
@@ -1465,11 +1477,13 @@ VolumeViaStrain::VolumeViaStrain(std::vector<double> &paraValue,
                                  std::vector<std::vector<size_t>> &indValue) {
   // Do some checks on the parameters and variable indeces
   //////////////////////////////////////////////////////////////////////
-  if (paraValue.size() != 4) {
+  if (paraValue.size() != 4 && paraValue.size() != 5) {
     std::cerr << "DivisionVolumeViaStrain::"
               << "DivisionVolumeViaStrain() "
               << "Four parameters used V_threshold, LWall_frac, "
-              << "Lwall_threshold, and Parallell_flag" << std::endl;
+              << "Lwall_threshold, and Parallell_flag, and an optional "
+              << "buffer_flag (1 = use the vertex derivatives of the last solver step)"
+              << std::endl;
     exit(0);
   }
   if (indValue.size() != 1) {
@@ -1494,6 +1508,7 @@ VolumeViaStrain::VolumeViaStrain(std::vector<double> &paraValue,
   tmp[1] = "LWall_frac";
   tmp[2] = "LWall_threshold";
   tmp[3] = "Parallell_flag";
+  if (numParameter() == 5) tmp[4] = "buffer_flag";
   setParameterId(tmp);
 }
 
@@ -1529,10 +1544,23 @@ void VolumeViaStrain::update(Tissue *T, size_t cellI, DataMatrix &cellData,
   // by using x,x+dt*dx/dt as two points
   //////////////////////////////////////////////////////////////////////
 
-  T->derivs(cellData, wallData, vertexData, cellDeriv, wallDeriv, vertexDeriv);
+  // The tissue is evaluated (all reactions for all cells) to get the vertex
+  // velocities. With buffer_flag set they are instead read from the derivatives
+  // of the last solver evaluation, unless these are missing for the cell.
+  size_t numV = divCell->numVertex();
+  int derivsFlag = 1;
+  if (numParameter() == 5 && parameter(4) == 1.0) {
+    for (size_t i = 0; i < numV && derivsFlag; ++i) {
+      size_t vI = divCell->vertex(i)->index();
+      if (vI < vertexDeriv.size() && vertexDeriv[vI].size() >= dimension &&
+          (vertexDeriv[vI][0] != 0.0 || vertexDeriv[vI][1] != 0.0))
+        derivsFlag = 0;
+    }
+  }
+  if (derivsFlag)
+    T->derivs(cellData, wallData, vertexData, cellDeriv, wallDeriv, vertexDeriv);
 
   // Create temporary x,y,dx positions
-  size_t numV = divCell->numVertex();
   DataMatrix x(numV), y(numV), dx(numV), xM(numV), yM(numV), dxM(numV);
 
   double dt = 1.0;
@@ -1755,9 +1783,11 @@ void VolumeViaStrain::update(Tissue *T, size_t cellI, DataMatrix &cellData,
   size_t numWallTmp = wallData.size();
   assert(numWallTmp == T->numWall());
   // Divide
+  CompartmentProfile::startDivideCell();
   T->divideCell(divCell, wI[0], wI[1], v1Pos, v2Pos, cellData, wallData,
                 vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
                 parameter(2));
+  CompartmentProfile::stopDivideCell();
   assert(numWallTmp + 3 == T->numWall());
 
   // Change length of new wall between the divided daugther cells
@@ -1905,9 +1935,11 @@ void VolumeViaStrain::update(Tissue *T, size_t cellI, DataMatrix &cellData,
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI[0], wI[1], v1Pos, v2Pos, cellData, wallData,
 		  vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(1),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
   
     // Change length of new wall between the divided daugther cells
@@ -2076,9 +2108,11 @@ void VolumeViaStrain::update(Tissue *T, size_t cellI, DataMatrix &cellData,
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI[0], wI[1], v1Pos, v2Pos, cellData, wallData,
 		  vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(1),
 		  parameter(5));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -2298,9 +2332,11 @@ void VolumeViaStrain::update(Tissue *T, size_t cellI, DataMatrix &cellData,
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI[0], wI[1], v1Pos, v2Pos, cellData, wallData,
 		  vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -2573,10 +2609,12 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     exit(EXIT_FAILURE);
   }
 
+  CompartmentProfile::startDivideCell();
   T->divideCell(&cell, candidateWalls[0], candidateWalls[1],
                 verticesPosition[0], verticesPosition[1], cellData, wallData,
                 vertexData, cellDerivs, wallDerivs, vertexDerivs,
                 variableIndex(0), parameter(2));
+  CompartmentProfile::stopDivideCell();
 
   // Change length of new wall between the divided daugther cells
   wallData[T->numWall() - 1][0] *= parameter(1);
@@ -2875,9 +2913,11 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     size_t numWallTmp = wallData.size();
     assert(numWallTmp == T->numWall());
     // Divide
+    CompartmentProfile::startDivideCell();
     T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
 		  cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
 		  parameter(2));
+    CompartmentProfile::stopDivideCell();
     assert(numWallTmp + 3 == T->numWall());
     
     // Change length of new wall between the divided daugther cells
@@ -2889,15 +2929,21 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
   
   ShortestPath2DRandomized::ShortestPath2DRandomized(std::vector<double> &paraValue,
 				 std::vector<std::vector<size_t>> &indValue) {
-    if (paraValue.size() != 6) {
+    if (paraValue.size() != 6 && paraValue.size() != 7) {
       std::cerr
         << "Division::ShortestPath2DRandomized::ShortestPath2DRandomized() "
-        << "Five parameters are used: V_threshold, Lwall_fraction, "
+        << "Six parameters are used: V_threshold, Lwall_fraction, "
         << "Lwall_threshold,  COM (1 = COM, 0 = Random), random div frequency, "
-        << "and random div location frequency."
+        << "and random div location frequency, and optionally schedule_flag "
+        << "(1 = only check cells predicted to divide)."
         << std::endl;
       std::exit(EXIT_FAILURE);
     }
+    if (paraValue.size() == 7 && paraValue[6] != 0.0 && paraValue[6] != 1.0) {
+      std::cerr << "Division::ShortestPath2DRandomized::ShortestPath2DRandomized() "
+		<< "schedule_flag must be 0 or 1." << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
 
     if ((indValue.size() == 2 && indValue[1].size() != 1) ||
 	(indValue.size() != 1 && indValue.size() != 2) ) {
@@ -2922,7 +2968,14 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     tmp[3] = "COM";
     tmp[4] = "RandDivFreq";
     tmp[5] = "RandDivLocFreq";
+    if (numParameter() == 7)
+      tmp[6] = "schedule_flag";
     setParameterId(tmp);
+    
+    if (numParameter() == 7 && parameter(6) == 1.0) {
+      Checkpoint::instance().add(id(), &scheduler_);
+      scheduler_.useJournal();
+    }
   }
 
   int ShortestPath2DRandomized::
@@ -2930,7 +2983,19 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
        DataMatrix &wallData, DataMatrix &vertexData,
        DataMatrix &cellDerivs, DataMatrix &wallDerivs,
        DataMatrix &vertexDerivs) {
-       
+    
+    if (numParameter() == 7 && parameter(6) == 1.0) {
+      // Only calculate the volume when the cell is predicted to reach the threshold
+      // or a random division event (sampled geometrically) is due
+      scheduler_.visit(*T, i);
+      bool randomEvent = scheduler_.randomEvent(i, parameter(4));
+      if (!randomEvent && !scheduler_.due(i))
+	return 0;
+      double vol = T->cell(i).calculateVolume(vertexData);
+      scheduler_.observe(i, vol, parameter(0));
+      return vol > parameter(0) || (randomEvent && vol > .5*parameter(0));
+    }
+    
     double r = 0.0;
     r = myRandom::Rnd();
     
@@ -2973,6 +3038,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
                     wallDerivs, vertexDerivs);
     
     if (candidates.size() == 0) {
+      CompartmentProfile::emptyCandidates();
       std::cerr << "Division::ShortestPath2DRandomized.update() WARNING, cell " << i
 		<< " marked for division but no candidate shortest path found."
 		<< std::endl;
@@ -3013,9 +3079,12 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
       cellData[cell.index()][timeIndex] = 0.0;
     }
     
+    CompartmentProfile::startDivideCell();
     T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
 		  vertexData, cellDerivs, wallDerivs, vertexDerivs,
 		  variableIndex(0), parameter(2));
+    CompartmentProfile::stopDivideCell();
+    scheduler_.reset(i);
     size_t numWallTmp = wallData.size();
     assert(numWallTmp + 3 == T->numWall());
     
@@ -3210,7 +3279,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	// std::cerr << " distance = " << distance <<
 	// std::endl;
 	
-	if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) { // discard selection if outside of walls
+	if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) { // discard selection if outside of walls
 	  // std::cerr << "Discard from possible wall combination" << std::endl;
 	  continue;
 	} else {
@@ -3338,6 +3407,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
                     wallDerivs, vertexDerivs);
     
     if (candidates.size() == 0) {
+      CompartmentProfile::emptyCandidates();
       std::cerr << "Division::shortestPath2D.update() WARNING, cell " << i
 		<< " marked for division but no candidate shortest path found."
 		<< std::endl;
@@ -3378,9 +3448,11 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
       cellData[cell.index()][timeIndex] = 0.0;
     }
     
+    CompartmentProfile::startDivideCell();
     T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
 		  vertexData, cellDerivs, wallDerivs, vertexDerivs,
 		  variableIndex(0), parameter(2));
+    CompartmentProfile::stopDivideCell();
     size_t numWallTmp = wallData.size();
     assert(numWallTmp + 3 == T->numWall());
     
@@ -3572,7 +3644,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	// std::cerr << " distance = " << distance <<
 	// std::endl;
 	
-	if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) { // discard selection if outside of walls
+	if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) { // discard selection if outside of walls
 	  // std::cerr << "Discard from possible wall combination" << std::endl;
 	  continue;
 	} else {
@@ -3705,6 +3777,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
                     wallDerivs, vertexDerivs);
     
     if (candidates.size() == 0) {
+      CompartmentProfile::emptyCandidates();
       std::cerr << "Division::shortestPath2D.update() WARNING, cell " << i
 		<< " marked for division but no candidate shortest path found."
 		<< std::endl;
@@ -3733,9 +3806,11 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     q[0] = winner.qx;
     q[1] = winner.qy;
     
+    CompartmentProfile::startDivideCell();
     T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
 		  vertexData, cellDerivs, wallDerivs, vertexDerivs,
 		  variableIndex(0), parameter(5));
+    CompartmentProfile::stopDivideCell();
     size_t numWallTmp = wallData.size();
     assert(numWallTmp + 3 == T->numWall());
     
@@ -3880,7 +3955,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	double distance =
           std::sqrt((qx - px) * (qx - px) + (qy - py) * (qy - py));
 	
-	if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) { // discard selection if outside of walls
+	if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) { // discard selection if outside of walls
 	  // std::cerr << "Discard from possible wall combination" << std::endl;
 	  continue;
 	} else {
@@ -3936,6 +4011,176 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     return tmp;
   }
 
+  ProjectedCellPositions::
+  ProjectedCellPositions(Cell &cell, const DataMatrix &vertexData)
+    : cellIndex_(cell.index()), vertexIndex_(cell.numVertex()),
+      position_(cell.numVertex(), std::vector<double>(3)), center_(3)
+  {
+    // Finding the average normal vector to the cell plane
+    std::vector<double> normal(3);
+    normal[0] = 0;
+    normal[1] = 0;
+    normal[2] = 0;
+    for (size_t k = 1; k < cell.numWall() - 1; ++k) {
+      size_t ind1 = cell.vertex(0)->index();
+      size_t ind2 = cell.vertex(k)->index();
+      size_t ind3 = cell.vertex(k + 1)->index();
+      normal[0] += (vertexData[ind2][1] - vertexData[ind1][1]) *
+	(vertexData[ind3][2] - vertexData[ind1][2]) -
+	(vertexData[ind2][2] - vertexData[ind1][2]) *
+	(vertexData[ind3][1] - vertexData[ind1][1]);
+      normal[1] += (vertexData[ind2][2] - vertexData[ind1][2]) *
+	(vertexData[ind3][0] - vertexData[ind1][0]) -
+	(vertexData[ind2][0] - vertexData[ind1][0]) *
+	(vertexData[ind3][2] - vertexData[ind1][2]);
+      normal[2] += (vertexData[ind2][0] - vertexData[ind1][0]) *
+	(vertexData[ind3][1] - vertexData[ind1][1]) -
+	(vertexData[ind2][1] - vertexData[ind1][1]) *
+	(vertexData[ind3][0] - vertexData[ind1][0]);
+    }
+    double norm = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+			    normal[2] * normal[2]);
+    normal[0] /= norm;
+    normal[1] /= norm;
+    normal[2] /= norm;
+    
+    // rotation matrix for going to the plane perpendicular to the averaged normal
+    for (size_t ii = 0; ii < 3; ++ii)
+      for (size_t jj = 0; jj < 3; ++jj)
+	rot_[ii][jj] = ii == jj ? 1 : 0;
+    if (normal[2] != 1) {
+      rot_[0][0] = normal[2] + ((normal[1] * normal[1]) / (normal[2] + 1));
+      rot_[1][1] = normal[2] + ((normal[0] * normal[0]) / (normal[2] + 1));
+      rot_[0][1] = -(normal[0] * normal[1]) / (normal[2] + 1);
+      rot_[1][0] = -(normal[1] * normal[0]) / (normal[2] + 1);
+      
+      rot_[0][2] = -normal[0];
+      rot_[2][0] = normal[0];
+      rot_[1][2] = -normal[1];
+      rot_[2][1] = normal[1];
+      rot_[2][2] = normal[2];
+    }
+    
+    // rotated copy of the cell vertices, and their center
+    for (size_t k = 0; k < cell.numVertex(); ++k) {
+      vertexIndex_[k] = cell.vertex(k)->index();
+      for (size_t ii = 0; ii < 3; ++ii) {
+	for (size_t jj = 0; jj < 3; ++jj)
+	  position_[k][ii] += rot_[ii][jj] * vertexData[vertexIndex_[k]][jj];
+	center_[ii] += position_[k][ii] / cell.numVertex();
+      }
+    }
+  }
+  
+  const std::vector<double>& ProjectedCellPositions::
+  operator[](size_t vertexIndex) const
+  {
+    for (size_t k = 0; k < vertexIndex_.size(); ++k)
+      if (vertexIndex_[k] == vertexIndex)
+	return position_[k];
+    std::cerr << "ProjectedCellPositions::operator[]() Vertex " << vertexIndex
+	      << " is not a vertex of cell " << cellIndex_ << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  
+  std::vector<double> ProjectedCellPositions::
+  toTissue(double x, double y) const
+  {
+    std::vector<double> p(3);
+    for (size_t d = 0; d < 3; ++d)
+      p[d] = rot_[0][d] * x + rot_[1][d] * y + rot_[2][d] * center_[2];
+    return p;
+  }
+  
+  ///
+  /// @brief Origin of the shortest path search, the cell center (com) or a random position.
+  ///
+  /// Returns 0 if no random position was found inside the cell.
+  ///
+  static int cellOrigin(Cell &cell, DataMatrix &vertexData, bool com,
+			std::vector<double> &o)
+  {
+    if (com) {
+      o = cell.positionFromVertex(vertexData);
+      return 1;
+    }
+    try {
+      o = cell.randomPositionInCell(vertexData);
+    } catch (Cell::FailedToFindRandomPositionInCellException) {
+      return 0;
+    }
+    return 1;
+  }
+  
+  ///
+  /// @brief As above for other position containers (ProjectedCellPositions).
+  ///
+  /// Works on a copy of the cell vertex positions local to the call, such that cells can be
+  /// searched in parallel. The center is the vertex mean, and random positions are drawn by
+  /// rejection sampling in the bounding box with a crossing number test over the cell walls
+  /// (coordinates beyond xy are set to the vertex mean).
+  ///
+  template<class Positions>
+  static int cellOrigin(Cell &cell, Positions &vertexData, bool com,
+			std::vector<double> &o, size_t numTries = 10000)
+  {
+    size_t numVertex = cell.numVertex();
+    std::vector<double> x(numVertex), y(numVertex);
+    o.assign(vertexData[cell.vertex(0)->index()].size(), 0.0);
+    for (size_t k = 0; k < numVertex; ++k) {
+      size_t vI = cell.vertex(k)->index();
+      x[k] = vertexData[vI][0];
+      y[k] = vertexData[vI][1];
+      for (size_t d = 0; d < o.size(); ++d)
+	o[d] += vertexData[vI][d] / numVertex;
+    }
+    if (com)
+      return 1;
+    
+    // walls as pairs of cell-local vertices
+    std::vector<size_t> wallVertex(2 * cell.numWall());
+    for (size_t k = 0; k < cell.numWall(); ++k)
+      for (size_t kk = 0; kk < numVertex; ++kk) {
+	if (cell.vertex(kk) == cell.wall(k)->vertex1())
+	  wallVertex[2 * k] = kk;
+	if (cell.vertex(kk) == cell.wall(k)->vertex2())
+	  wallVertex[2 * k + 1] = kk;
+      }
+    double xMin = *std::min_element(x.begin(), x.end());
+    double xMax = *std::max_element(x.begin(), x.end());
+    double yMin = *std::min_element(y.begin(), y.end());
+    double yMax = *std::max_element(y.begin(), y.end());
+    for (size_t n = 0; n < numTries; ++n) {
+      double px = xMin + myRandom::Rnd() * (xMax - xMin);
+      double py = yMin + myRandom::Rnd() * (yMax - yMin);
+      int inside = 0;
+      for (size_t k = 0; k < cell.numWall(); ++k) {
+	double x1 = x[wallVertex[2 * k]], y1 = y[wallVertex[2 * k]];
+	double x2 = x[wallVertex[2 * k + 1]], y2 = y[wallVertex[2 * k + 1]];
+	if ((y1 > py) != (y2 > py) && px < x1 + (py - y1) * (x2 - x1) / (y2 - y1))
+	  inside = !inside;
+      }
+      if (inside) {
+	o[0] = px;
+	o[1] = py;
+	return 1;
+      }
+    }
+    return 0;
+  }
+  
+  template<class Candidate>
+  static Candidate shortestCandidate(const std::vector<Candidate> &candidates)
+  {
+    Candidate winner = candidates[0];
+    for (size_t k = 1; k < candidates.size(); ++k) {
+      if (candidates[k].distance < winner.distance) {
+	winner = candidates[k];
+      }
+    }
+    return winner;
+  }
+  
   ShortestPath::ShortestPath(std::vector<double> &paraValue,
 			     std::vector<std::vector<size_t>> &indValue) {
     if (paraValue.size() != 4 && paraValue.size() != 6) {
@@ -4007,237 +4252,26 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     //     std::exit(EXIT_FAILURE);
     //   }
     
-    // Projecting the cell to the perpendicular plane to the averaged normal
-    double rot[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
-    std::vector<std::vector<double>> verticesPosition;
-    verticesPosition.resize(cell.numVertex());
-    std::vector<double> centerTmp(3), COMTmp(3);
-    
+    // 3D cells are searched in a cell-local copy of the vertex positions, projected to
+    // the plane perpendicular to the averaged normal, such that the tissue data is not
+    // modified before the division itself
+    Candidate winner;
+    std::vector<double> p(3), q(3);
     if (vertexData[0].size() == 3) {
-      // storing the vertex positions
-      for (size_t k = 0; k < cell.numVertex(); ++k) {
-	verticesPosition[k].resize(3);
-	size_t Vind = cell.vertex(k)->index();
-	verticesPosition[k][0] = vertexData[Vind][0];
-	verticesPosition[k][1] = vertexData[Vind][1];
-	verticesPosition[k][2] = vertexData[Vind][2];
-      }
-      // storing COM position
-      if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-	COMTmp[0] = cellData[i][variableIndex(2, 0)];
-	COMTmp[1] = cellData[i][variableIndex(2, 0) + 1];
-	COMTmp[2] = cellData[i][variableIndex(2, 0) + 2];
-      }
-      // Finding the average normal vector to the cell plane
-      std::vector<double> normal(3);
-      normal[0] = 0;
-      normal[1] = 0;
-      normal[2] = 0;
-      
-      //  double area=0;
-      for (size_t k = 1; k < cell.numWall() - 1; ++k) {
-	std::vector<double> x0(3), x1(3), x2(3);
-	size_t ind1 = cell.vertex(0)->index();
-	size_t ind2 = cell.vertex(k)->index();
-	size_t ind3 = cell.vertex(k + 1)->index();
-	// std::cerr<<ind1<<" "<<ind2<<" "<<ind3<<" "<<std::endl;
-	// normal to the element
-	std::vector<double> temp(3);
-	temp[0] = (vertexData[ind2][1] - vertexData[ind1][1]) *
-	  (vertexData[ind3][2] - vertexData[ind1][2]) -
-	  (vertexData[ind2][2] - vertexData[ind1][2]) *
-	  (vertexData[ind3][1] - vertexData[ind1][1]);
-	temp[1] = (vertexData[ind2][2] - vertexData[ind1][2]) *
-	  (vertexData[ind3][0] - vertexData[ind1][0]) -
-	  (vertexData[ind2][0] - vertexData[ind1][0]) *
-	  (vertexData[ind3][2] - vertexData[ind1][2]);
-	temp[2] = (vertexData[ind2][0] - vertexData[ind1][0]) *
-	  (vertexData[ind3][1] - vertexData[ind1][1]) -
-	  (vertexData[ind2][1] - vertexData[ind1][1]) *
-	  (vertexData[ind3][0] - vertexData[ind1][0]);
-	
-	normal[0] += temp[0];
-	normal[1] += temp[1];
-	normal[2] += temp[2];
-	// std::cerr<<normal[0]<<" "<<normal[1]<<" "<<normal[2]<<"
-	// "<<area<<std::endl;
-	
-	// total area of the cell
-	// area +=std::sqrt(temp[0]*temp[0]+temp[1]*temp[1]+temp[2]*temp[2])/2;
-      }
-      double norm = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
-			      normal[2] * normal[2]);
-      // normalizing the normal vector
-      normal[0] /= norm;
-      normal[1] /= norm;
-      normal[2] /= norm;
-      // std::cerr<<normal[0]<<" "<<normal[1]<<" "<<normal[2]<<"
-      // "<<area<<std::endl;
-      
-      // std::cerr<<deltaTet<<" "<<nplane<<std::endl;
-      // rotation matrix for going to the perpendicular plane to thr averaged
-      // normal
-      
-      if (normal[2] != 1) {  // if there rotation matrix is not 1
-	rot[0][0] = normal[2] + ((normal[1] * normal[1]) / (normal[2] + 1));
-	rot[1][1] = normal[2] + ((normal[0] * normal[0]) / (normal[2] + 1));
-	rot[0][1] = -(normal[0] * normal[1]) / (normal[2] + 1);
-	rot[1][0] = -(normal[1] * normal[0]) / (normal[2] + 1);
-	
-	rot[0][2] = -normal[0];
-	rot[2][0] = normal[0];
-	rot[1][2] = -normal[1];
-	rot[2][1] = normal[1];
-	rot[2][2] = normal[2];
-      }
-      // rotating the cell vertices
-      // std::vector<double> tmpVertex(3);
-      
-      for (size_t k = 0; k < cell.numVertex(); ++k) {
-	size_t Vind = cell.vertex(k)->index();
-	for (size_t ii = 0; ii < 3; ++ii) {
-	  vertexData[Vind][ii] = 0;
-	  for (size_t jj = 0; jj < 3; ++jj) {
-	    vertexData[Vind][ii] += rot[ii][jj] * verticesPosition[k][jj];
-	  }
-	}
-      }
-      
-      // rotating the center is cell is centertriangulated
-      if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-	cellData[i][variableIndex(2, 0)] =
-          rot[0][0] * COMTmp[0] + rot[0][1] * COMTmp[1] + rot[0][2] * COMTmp[2];
-	cellData[i][variableIndex(2, 0) + 1] =
-          rot[1][0] * COMTmp[0] + rot[1][1] * COMTmp[1] + rot[1][2] * COMTmp[2];
-	cellData[i][variableIndex(2, 0) + 2] =
-          rot[2][0] * COMTmp[0] + rot[2][1] * COMTmp[1] + rot[2][2] * COMTmp[2];
-      }
-      
-      centerTmp = cell.positionFromVertex(vertexData);
-      
-      // std::cerr<<"normal "<<normal[0]<<" "<<normal[1]<<"
-      // "<<normal[2]<<std::endl;
-      //  for(size_t k=0; k< cell.numVertex(); ++k){
-      //    size_t Vind=cell.vertex(k) -> index();
-      //    std::cerr<<"vertex "<<k<<" "
-      //             <<vertexData[Vind][0]<<" "
-      //             <<vertexData[Vind][1]<<" "
-      //             <<vertexData[Vind][2]<<std::endl;
-      //  }
-      //  std::cerr<<"cell center "
-      //           <<cellData[i][variableIndex(2,0)  ]<<" "
-      //           <<cellData[i][variableIndex(2,0)+1]<<" "
-      //           <<cellData[i][variableIndex(2,0)+2]<<std::endl;
-      //  std::cerr<<"cell centroid "
-      //           <<centerTmp[0]<<" "
-      //           <<centerTmp[1]<<" "
-      //           <<centerTmp[2]<<std::endl;
-    } // end if (vertex[0].size==3)
-    
-    //  // Find intersection with another wall
-    //  //
-    //  size_t w3I=divCell->numWall();
-    //  //double minDist,w3s;
-    // std::vector<size_t> w3Tmp;
-    //  std::vector<double> w3tTmp;
-    //  int flag=0,vertexFlag=0;
-    //  for( size_t k=0 ; k<divCell->numWall() ; ++k ) {
-    //    if( k!=wI ) {
-    //      size_t v1w3Itmp = divCell->wall(k)->vertex1()->index();
-    //      size_t v2w3Itmp = divCell->wall(k)->vertex2()->index();
-    //      std::vector<double> w3(dimension),w0(dimension);
-    //      for( size_t d=0 ; d<dimension ; ++d ) {
-    //        w3[d] = vertexData[v2w3Itmp][d]-vertexData[v1w3Itmp][d];
-    //        w0[d] = v1Pos[d]-vertexData[v1w3Itmp][d];
-    
-    std::vector<Candidate> candidates =
-      getCandidates(T, i, cellData, wallData, vertexData, cellDerivs,
-                    wallDerivs, vertexDerivs);
-    
-    if (candidates.size() == 0) {
-      return;
-    }
-    
-    Candidate winner = {std::numeric_limits<double>::max(), 0, 0, 0, 0, 0, 0};
-    for (size_t i = 0; i < candidates.size(); ++i) {
-      if (candidates[i].distance < winner.distance) {
-	winner = candidates[i];
+      ProjectedCellPositions projected(cell, vertexData);
+      std::vector<Candidate> candidates = getCandidates(T, i, projected);
+      if (candidates.size() == 0) {
+        CompartmentProfile::emptyCandidates();
+        return;
       }
-    }
-    
-    // std::cerr << "Winner: " << std::endl
-    //           << " distance = " << winner.distance << std::endl
-    //           << " p = (" << winner.px << ", " << winner.py << ")" << std::endl
-    //           << " q = (" << winner.qx << ", " << winner.qy << ")" <<
-    //           std::endl;
-    
-    assert(wallData.size() == T->numWall());
-    
-    std::vector<double> p(3);
-    p[0] = winner.px;
-    p[1] = winner.py;
-    std::vector<double> q(3);
-    q[0] = winner.qx;
-    q[1] = winner.qy;
-    
-    if (vertexData[0].size() == 3) {
-      double px = p[0], py = p[1], qx = q[0], qy = q[1];
-      // p.resize(3);
-      // q.resize(3);
-      // size_t V1W1=(cell.wall(winner.wall1) -> vertex1()) -> index();
-      // size_t V2W1=(cell.wall(winner.wall1) -> vertex2()) -> index();
-      // size_t V1W2=(cell.wall(winner.wall2) -> vertex1()) -> index();
-      // size_t V2W2=(cell.wall(winner.wall2) -> vertex2()) -> index();
-      
-      // std::cerr<<std::endl;
-      // std::cerr<<" v1w1 "<<vertexData[V1W1][0]<<"  "<<vertexData[V1W1][1]<<"
-      // "<<vertexData[V1W1][2]<<std::endl; std::cerr<<" v2w1
-      // "<<vertexData[V2W1][0]<<"  "<<vertexData[V2W1][1]<<"
-      // "<<vertexData[V2W1][2]<<std::endl; std::cerr<<" v1w2
-      // "<<vertexData[V1W2][0]<<"  "<<vertexData[V1W2][1]<<"
-      // "<<vertexData[V1W2][2]<<std::endl; std::cerr<<" v2w2
-      // "<<vertexData[V2W2][0]<<"  "<<vertexData[V2W2][1]<<"
-      // "<<vertexData[V2W2][2]<<std::endl; std::cerr<<" p "<<p[0]<<"  "<<p[1]<<"
-      // "<<p[2]<<std::endl; std::cerr<<" q "<<q[0]<<"  "<<q[1]<<"
-      // "<<q[2]<<std::endl; std::cerr<<" com "<<COMTmp[0]<<"  "<<COMTmp[1]<<"
-      // "<<COMTmp[2]<<std::endl;
-      
-      // //testing the rotation matrix
-      // std::vector<std::vector<double> > rotTemp(3);
-      // for(size_t iii=0; iii< 3; ++iii)
-      //   rotTemp[iii].resize(3);
-      // for(size_t iii=0; iii< 3; ++iii)
-      //   for(size_t jjj=0; jjj<3; ++jjj)
-      //     for(size_t kkk=0; kkk<3; ++kkk)
-      //       rotTemp[iii][jjj]+=rot[iii][kkk]*rot[jjj][kkk];
-      // for(size_t iii=0; iii< 3; ++iii)
-      //   std::cerr<<"rot   "<<rotTemp[iii][0]<<" "<<rotTemp[iii][1]<<"
-      //   "<<rotTemp[iii][2]<<std::endl;
+      winner = shortestCandidate(candidates);
       
       // rotating back the found positions for division points
-      
-      p[0] = rot[0][0] * px + rot[1][0] * py + rot[2][0] * centerTmp[2];
-      p[1] = rot[0][1] * px + rot[1][1] * py + rot[2][1] * centerTmp[2];
-      p[2] = rot[0][2] * px + rot[1][2] * py + rot[2][2] * centerTmp[2];
-      
-      q[0] = rot[0][0] * qx + rot[1][0] * qy + rot[2][0] * centerTmp[2];
-      q[1] = rot[0][1] * qx + rot[1][1] * qy + rot[2][1] * centerTmp[2];
-      q[2] = rot[0][2] * qx + rot[1][2] * qy + rot[2][2] * centerTmp[2];
+      p = projected.toTissue(winner.px, winner.py);
+      q = projected.toTissue(winner.qx, winner.qy);
       // these positions might be out of walls but close, depending on the
       // flatness of the cell plane
       
-      for (size_t k = 0; k < cell.numVertex(); ++k) {  // copying back the original positions
-	size_t Vind = cell.vertex(k)->index();
-	for (size_t ii = 0; ii < 3; ++ii)
-	  vertexData[Vind][ii] = verticesPosition[k][ii];
-      }
-      // copynig back the centerCOM
-      if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-	cellData[i][variableIndex(2, 0)] = COMTmp[0];
-	cellData[i][variableIndex(2, 0) + 1] = COMTmp[1];
-	cellData[i][variableIndex(2, 0) + 2] = COMTmp[2];
-      }
-      
       size_t V1W1 = (cell.wall(winner.wall1)->vertex1())->index();
       size_t V2W1 = (cell.wall(winner.wall1)->vertex2())->index();
       size_t V1W2 = (cell.wall(winner.wall2)->vertex1())->index();
@@ -4305,7 +4339,20 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	std::cerr << " in DivisionShortestPath q is wrong" << std::endl;
 	exit(0);
       }
-    } // end if (vertexData[0].size()==3)
+    }
+    else {
+      std::vector<Candidate> candidates = getCandidates(T, i, vertexData);
+      if (candidates.size() == 0) {
+        CompartmentProfile::emptyCandidates();
+        return;
+      }
+      winner = shortestCandidate(candidates);
+      p[0] = winner.px;
+      p[1] = winner.py;
+      q[0] = winner.qx;
+      q[1] = winner.qy;
+    }
+    assert(wallData.size() == T->numWall());
     
     // std::cerr<<" before:: "<<std::endl;
     // for(size_t k=0; k< cellData[cell.index()].size(); ++k)
@@ -4332,10 +4379,13 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	exit(EXIT_FAILURE);
       }
     }
-    else // not centerTriangulation
+    else { // not centerTriangulation
+      CompartmentProfile::startDivideCell();
       T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
 		    vertexData, cellDerivs, wallDerivs, vertexDerivs,
 		    variableIndex(0), parameter(2));
+      CompartmentProfile::stopDivideCell();
+    }
     size_t numWallTmp = wallData.size();
     assert(numWallTmp + 3 == T->numWall());
     
@@ -4352,25 +4402,17 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
     // T->checkConnectivity(1);
   }
 
+  template<class Positions>
   std::vector<ShortestPath::Candidate> ShortestPath::
-  getCandidates(
-		Tissue *T, size_t i, DataMatrix &cellData, DataMatrix &wallData,
-		DataMatrix &vertexData, DataMatrix &cellDerivs, DataMatrix &wallDerivs,
-		DataMatrix &vertexDerivs) {
-    Cell cell = T->cell(i);
+  getCandidates(Tissue *T, size_t i, Positions &vertexData) {
+    Cell &cell = T->cell(i);
     
     assert(cell.numWall() > 1);
     
     std::vector<double> o;
     
-    if (parameter(3) == 1) {
-      o = cell.positionFromVertex(vertexData);
-    } else {
-      try {
-	o = cell.randomPositionInCell(vertexData);
-      } catch (Cell::FailedToFindRandomPositionInCellException) {
-	return std::vector<Candidate>();
-      }
+    if (!cellOrigin(cell, vertexData, parameter(3) == 1, o)) {
+      return std::vector<Candidate>();
     }
 
     double ox = o[0];
@@ -4543,7 +4585,7 @@ void ForceDirection::update(Tissue *T, size_t i, DataMatrix &cellData,
 	//   			std::cerr << " distance = " << distance <<
 	//   std::endl;
 	
-	if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) {
+	if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) {
 	  //   				std::cerr << "Discard" << std::endl;
         continue;
 	} else {
@@ -4672,223 +4714,26 @@ void STAViaShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
   //     dimensions.\n"; std::exit(EXIT_FAILURE);
   //   }
 
-  // projecting the cell to the perpendicular plane to the averaged normal
-  double rot[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
-  std::vector<std::vector<double>> verticesPosition;
-  verticesPosition.resize(cell.numVertex());
-  std::vector<double> centerTmp(3), COMTmp(3);
-
+  // 3D cells are searched in a cell-local copy of the vertex positions, projected to
+  // the plane perpendicular to the averaged normal, such that the tissue data is not
+  // modified before the division itself
+  Candidate winner;
+  std::vector<double> p(3), q(3);
   if (vertexData[0].size() == 3) {
-    // storing the vertex positions
-    for (size_t k = 0; k < cell.numVertex(); ++k) {
-      verticesPosition[k].resize(3);
-      size_t Vind = cell.vertex(k)->index();
-      verticesPosition[k][0] = vertexData[Vind][0];
-      verticesPosition[k][1] = vertexData[Vind][1];
-      verticesPosition[k][2] = vertexData[Vind][2];
-    }
-    // storing COM position
-    if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-      COMTmp[0] = cellData[i][variableIndex(2, 0)];
-      COMTmp[1] = cellData[i][variableIndex(2, 0) + 1];
-      COMTmp[2] = cellData[i][variableIndex(2, 0) + 2];
-    }
-    // Finding the average normal vector to the cell plane
-    std::vector<double> normal(3);
-    normal[0] = 0;
-    normal[1] = 0;
-    normal[2] = 0;
-
-    //  double area=0;
-    for (size_t k = 1; k < cell.numWall() - 1; ++k) {
-      std::vector<double> x0(3), x1(3), x2(3);
-      size_t ind1 = cell.vertex(0)->index();
-      size_t ind2 = cell.vertex(k)->index();
-      size_t ind3 = cell.vertex(k + 1)->index();
-      // std::cerr<<ind1<<" "<<ind2<<" "<<ind3<<" "<<std::endl;
-      // normal to the element
-      std::vector<double> temp(3);
-      temp[0] = (vertexData[ind2][1] - vertexData[ind1][1]) *
-                    (vertexData[ind3][2] - vertexData[ind1][2]) -
-                (vertexData[ind2][2] - vertexData[ind1][2]) *
-                    (vertexData[ind3][1] - vertexData[ind1][1]);
-      temp[1] = (vertexData[ind2][2] - vertexData[ind1][2]) *
-                    (vertexData[ind3][0] - vertexData[ind1][0]) -
-                (vertexData[ind2][0] - vertexData[ind1][0]) *
-                    (vertexData[ind3][2] - vertexData[ind1][2]);
-      temp[2] = (vertexData[ind2][0] - vertexData[ind1][0]) *
-                    (vertexData[ind3][1] - vertexData[ind1][1]) -
-                (vertexData[ind2][1] - vertexData[ind1][1]) *
-                    (vertexData[ind3][0] - vertexData[ind1][0]);
-
-      normal[0] += temp[0];
-      normal[1] += temp[1];
-      normal[2] += temp[2];
-      // std::cerr<<normal[0]<<" "<<normal[1]<<" "<<normal[2]<<"
-      // "<<area<<std::endl;
-
-      // total area of the cell
-      // area +=std::sqrt(temp[0]*temp[0]+temp[1]*temp[1]+temp[2]*temp[2])/2;
-    }
-    double norm = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
-                            normal[2] * normal[2]);
-    // normalizing the normal vector
-    normal[0] /= norm;
-    normal[1] /= norm;
-    normal[2] /= norm;
-    // std::cerr<<normal[0]<<" "<<normal[1]<<" "<<normal[2]<<"
-    // "<<area<<std::endl;
-
-    // std::cerr<<deltaTet<<" "<<nplane<<std::endl;
-    // rotation matrix for going to the perpendicular plane to thr averaged
-    // normal
-
-    if (normal[2] != 1) {  // if there rotation matrix is not 1
-      rot[0][0] = normal[2] + ((normal[1] * normal[1]) / (normal[2] + 1));
-      rot[1][1] = normal[2] + ((normal[0] * normal[0]) / (normal[2] + 1));
-      rot[0][1] = -(normal[0] * normal[1]) / (normal[2] + 1);
-      rot[1][0] = -(normal[1] * normal[0]) / (normal[2] + 1);
-
-      rot[0][2] = -normal[0];
-      rot[2][0] = normal[0];
-      rot[1][2] = -normal[1];
-      rot[2][1] = normal[1];
-      rot[2][2] = normal[2];
-    }
-    // rotating the cell vertices
-    // std::vector<double> tmpVertex(3);
-
-    for (size_t k = 0; k < cell.numVertex(); ++k) {
-      size_t Vind = cell.vertex(k)->index();
-      for (size_t ii = 0; ii < 3; ++ii) {
-        vertexData[Vind][ii] = 0;
-        for (size_t jj = 0; jj < 3; ++jj) {
-          vertexData[Vind][ii] += rot[ii][jj] * verticesPosition[k][jj];
-        }
-      }
-    }
-
-    // rotating the center is cell is centertriangulated
-    if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-      cellData[i][variableIndex(2, 0)] =
-          rot[0][0] * COMTmp[0] + rot[0][1] * COMTmp[1] + rot[0][2] * COMTmp[2];
-      cellData[i][variableIndex(2, 0) + 1] =
-          rot[1][0] * COMTmp[0] + rot[1][1] * COMTmp[1] + rot[1][2] * COMTmp[2];
-      cellData[i][variableIndex(2, 0) + 2] =
-          rot[2][0] * COMTmp[0] + rot[2][1] * COMTmp[1] + rot[2][2] * COMTmp[2];
-    }
-
-    centerTmp = cell.positionFromVertex(vertexData);
-
-    // std::cerr<<"normal "<<normal[0]<<" "<<normal[1]<<"
-    // "<<normal[2]<<std::endl;
-    //  for(size_t k=0; k< cell.numVertex(); ++k){
-    //    size_t Vind=cell.vertex(k) -> index();
-    //    std::cerr<<"vertex "<<k<<" "
-    //             <<vertexData[Vind][0]<<" "
-    //             <<vertexData[Vind][1]<<" "
-    //             <<vertexData[Vind][2]<<std::endl;
-    //  }
-    //  std::cerr<<"cell center "
-    //           <<cellData[i][variableIndex(2,0)  ]<<" "
-    //           <<cellData[i][variableIndex(2,0)+1]<<" "
-    //           <<cellData[i][variableIndex(2,0)+2]<<std::endl;
-    //  std::cerr<<"cell centroid "
-    //           <<centerTmp[0]<<" "
-    //           <<centerTmp[1]<<" "
-    //           <<centerTmp[2]<<std::endl;
-  }
-  std::vector<Candidate> candidates =
-      getCandidates(T, i, cellData, wallData, vertexData, cellDerivs,
-                    wallDerivs, vertexDerivs);
-
-  if (candidates.size() == 0) {
-    return;
-  }
-
-  Candidate winner = {std::numeric_limits<double>::max(), 0, 0, 0, 0, 0, 0};
-  for (size_t i = 0; i < candidates.size(); ++i) {
-    if (candidates[i].distance < winner.distance) {
-      winner = candidates[i];
+    ProjectedCellPositions projected(cell, vertexData);
+    std::vector<Candidate> candidates = getCandidates(T, i, projected);
+    if (candidates.size() == 0) {
+      CompartmentProfile::emptyCandidates();
+      return;
     }
-  }
-
-  // std::cerr << "Winner: " << std::endl
-  //           << " distance = " << winner.distance << std::endl
-  //           << " p = (" << winner.px << ", " << winner.py << ")" << std::endl
-  //           << " q = (" << winner.qx << ", " << winner.qy << ")" <<
-  //           std::endl;
-
-  size_t numWallTmp = wallData.size();
-  assert(numWallTmp == T->numWall());
-
-  std::vector<double> p(3);
-  p[0] = winner.px;
-  p[1] = winner.py;
-  std::vector<double> q(3);
-  q[0] = winner.qx;
-  q[1] = winner.qy;
-
-  if (vertexData[0].size() == 3) {
-    double px = p[0], py = p[1], qx = q[0], qy = q[1];
-    // p.resize(3);
-    // q.resize(3);
-
-    // size_t V1W1=(cell.wall(winner.wall1) -> vertex1()) -> index();
-    // size_t V2W1=(cell.wall(winner.wall1) -> vertex2()) -> index();
-    // size_t V1W2=(cell.wall(winner.wall2) -> vertex1()) -> index();
-    // size_t V2W2=(cell.wall(winner.wall2) -> vertex2()) -> index();
-
-    // std::cerr<<std::endl;
-    // std::cerr<<" v1w1 "<<vertexData[V1W1][0]<<"  "<<vertexData[V1W1][1]<<"
-    // "<<vertexData[V1W1][2]<<std::endl; std::cerr<<" v2w1
-    // "<<vertexData[V2W1][0]<<"  "<<vertexData[V2W1][1]<<"
-    // "<<vertexData[V2W1][2]<<std::endl; std::cerr<<" v1w2
-    // "<<vertexData[V1W2][0]<<"  "<<vertexData[V1W2][1]<<"
-    // "<<vertexData[V1W2][2]<<std::endl; std::cerr<<" v2w2
-    // "<<vertexData[V2W2][0]<<"  "<<vertexData[V2W2][1]<<"
-    // "<<vertexData[V2W2][2]<<std::endl; std::cerr<<" p "<<p[0]<<"  "<<p[1]<<"
-    // "<<p[2]<<std::endl; std::cerr<<" q "<<q[0]<<"  "<<q[1]<<"
-    // "<<q[2]<<std::endl; std::cerr<<" com "<<COMTmp[0]<<"  "<<COMTmp[1]<<"
-    // "<<COMTmp[2]<<std::endl;
-
-    // //testing the rotation matrix
-    // std::vector<std::vector<double> > rotTemp(3);
-    // for(size_t iii=0; iii< 3; ++iii)
-    //   rotTemp[iii].resize(3);
-    // for(size_t iii=0; iii< 3; ++iii)
-    //   for(size_t jjj=0; jjj<3; ++jjj)
-    //     for(size_t kkk=0; kkk<3; ++kkk)
-    //       rotTemp[iii][jjj]+=rot[iii][kkk]*rot[jjj][kkk];
-    // for(size_t iii=0; iii< 3; ++iii)
-    //   std::cerr<<"rot   "<<rotTemp[iii][0]<<" "<<rotTemp[iii][1]<<"
-    //   "<<rotTemp[iii][2]<<std::endl;
-
+    winner = shortestCandidate(candidates);
+    
     // rotating back the found positions for division points
-
-    p[0] = rot[0][0] * px + rot[1][0] * py + rot[2][0] * centerTmp[2];
-    p[1] = rot[0][1] * px + rot[1][1] * py + rot[2][1] * centerTmp[2];
-    p[2] = rot[0][2] * px + rot[1][2] * py + rot[2][2] * centerTmp[2];
-
-    q[0] = rot[0][0] * qx + rot[1][0] * qy + rot[2][0] * centerTmp[2];
-    q[1] = rot[0][1] * qx + rot[1][1] * qy + rot[2][1] * centerTmp[2];
-    q[2] = rot[0][2] * qx + rot[1][2] * qy + rot[2][2] * centerTmp[2];
+    p = projected.toTissue(winner.px, winner.py);
+    q = projected.toTissue(winner.qx, winner.qy);
     // these positions might be out of walls but close, depending on the
     // flatness of the cell plane
-
-    for (size_t k = 0; k < cell.numVertex();
-         ++k) {  // copying back the original positions
-      size_t Vind = cell.vertex(k)->index();
-      for (size_t ii = 0; ii < 3; ++ii)
-        vertexData[Vind][ii] = verticesPosition[k][ii];
-    }
-    // copynig back the centerCOM
-    if (numParameter() == 6 && parameter(4) == 1) {  // centerTriangulation
-      cellData[i][variableIndex(2, 0)] = COMTmp[0];
-      cellData[i][variableIndex(2, 0) + 1] = COMTmp[1];
-      cellData[i][variableIndex(2, 0) + 2] = COMTmp[2];
-    }
-
+    
     size_t V1W1 = (cell.wall(winner.wall1)->vertex1())->index();
     size_t V2W1 = (cell.wall(winner.wall1)->vertex2())->index();
     size_t V1W2 = (cell.wall(winner.wall2)->vertex1())->index();
@@ -4958,6 +4803,20 @@ void STAViaShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
       exit(0);
     }
   }
+  else {
+    std::vector<Candidate> candidates = getCandidates(T, i, vertexData);
+    if (candidates.size() == 0) {
+      CompartmentProfile::emptyCandidates();
+      return;
+    }
+    winner = shortestCandidate(candidates);
+    p[0] = winner.px;
+    p[1] = winner.py;
+    q[0] = winner.qx;
+    q[1] = winner.qy;
+  }
+  size_t numWallTmp = wallData.size();
+  assert(numWallTmp == T->numWall());
 
   // std::cerr<<" before:: "<<std::endl;
   // for(size_t k=0; k< cellData[cell.index()].size(); ++k)
@@ -4985,10 +4844,13 @@ void STAViaShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
       std::cerr << "parameter(5) should be 0 or 1" << std::endl;
       exit(-1);
     }
-  } else
+  } else {
+    CompartmentProfile::startDivideCell();
     T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
                   vertexData, cellDerivs, wallDerivs, vertexDerivs,
                   variableIndex(0), parameter(2));
+    CompartmentProfile::stopDivideCell();
+  }
 
   assert(numWallTmp + 3 == T->numWall());
 
@@ -5010,24 +4872,17 @@ void STAViaShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
   // T->checkConnectivity(1);
 }
 
-std::vector<STAViaShortestPath::Candidate> STAViaShortestPath::getCandidates(
-    Tissue *T, size_t i, DataMatrix &cellData, DataMatrix &wallData,
-    DataMatrix &vertexData, DataMatrix &cellDerivs, DataMatrix &wallDerivs,
-    DataMatrix &vertexDerivs) {
-  Cell cell = T->cell(i);
+template<class Positions>
+std::vector<STAViaShortestPath::Candidate>
+STAViaShortestPath::getCandidates(Tissue *T, size_t i, Positions &vertexData) {
+  Cell &cell = T->cell(i);
 
   assert(cell.numWall() > 1);
 
   std::vector<double> o;
 
-  if (parameter(3) == 1) {
-    o = cell.positionFromVertex(vertexData);
-  } else {
-    try {
-      o = cell.randomPositionInCell(vertexData);
-    } catch (Cell::FailedToFindRandomPositionInCellException) {
-      return std::vector<Candidate>();
-    }
+  if (!cellOrigin(cell, vertexData, parameter(3) == 1, o)) {
+    return std::vector<Candidate>();
   }
 
   double ox = o[0];
@@ -5200,7 +5055,7 @@ std::vector<STAViaShortestPath::Candidate> STAViaShortestPath::getCandidates(
       //   			std::cerr << " distance = " << distance <<
       //   std::endl;
 
-      if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) {
+      if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) {
         //   				std::cerr << "Discard" << std::endl;
         continue;
       } else {
@@ -5459,6 +5314,7 @@ void FlagResetShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
                     wallDerivs, vertexDerivs);
 
   if (candidates.size() == 0) {
+    CompartmentProfile::emptyCandidates();
     return;
   }
 
@@ -5645,9 +5501,11 @@ void FlagResetShortestPath::update(Tissue *T, size_t i, DataMatrix &cellData,
   } else {
     cellData[i][variableIndex(3, 0)] = 0;  // resetting flag to 0 when dividing
 
+    CompartmentProfile::startDivideCell();
     T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
                   vertexData, cellDerivs, wallDerivs, vertexDerivs,
                   variableIndex(0), parameter(2));
+    CompartmentProfile::stopDivideCell();
 
     // std::cerr<<"divided "<<i<<"\n"<<std::endl;
     // std::cerr<<cellData[i][5]<<"\n"<<std::endl;
@@ -5888,7 +5746,7 @@ FlagResetShortestPath::getCandidates(Tissue *T, size_t i, DataMatrix &cellData,
 
       //        std::cerr << " distance = " << distance << std::endl;
 
-      if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) {
+      if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) {
         //          std::cerr << "Discard" << std::endl;
         continue;
       } else {
@@ -6052,9 +5910,11 @@ void Random::update(Tissue *T, size_t i, DataMatrix &cellData,
         r * (vertexData[vertex2->index()][1] - vertexData[vertex1->index()][1]);
   }
 
+  CompartmentProfile::startDivideCell();
   T->divideCell(&cell, wall1Index, wall2Index, p, q, cellData, wallData,
                 vertexData, cellDerivs, wallDerivs, vertexDerivs,
                 variableIndex(0), parameter(2));
+  CompartmentProfile::stopDivideCell();
 
   // Change length of new wall between the divided daugther cells.
   wallData[T->numWall() - 1][0] *= parameter(1);
@@ -6203,84 +6063,19 @@ void MainAxis::update(Tissue *T, size_t cellI, DataMatrix &cellData,
 
   size_t numWallTmp = wallData.size();
 
+  CompartmentProfile::startDivideCell();
   T->divideCell(&cell, c1.index, c2.index, c1.p, c2.p, cellData, wallData,
                 vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
                 parameter(2));
+  CompartmentProfile::stopDivideCell();
 
   // Change length of new wall between the divided daugther cells
   wallData[numWallTmp][0] *= parameter(1);
 }
 
 std::vector<double> MainAxis::getMainAxis(Cell &cell, DataMatrix &vertexData) {
-  size_t dimensions = vertexData[0].size();
-  size_t numberOfVertices = cell.numVertex();
-
-  // Copy vertex data to temporary container and calculate mean values.
-
-  DataMatrix vertices(numberOfVertices);
-  for (size_t i = 0; i < numberOfVertices; ++i) {
-    vertices[i].resize(dimensions);
-  }
-  std::vector<double> mean(dimensions, 0.0);
-
-  for (size_t i = 0; i < numberOfVertices; ++i) {
-    Vertex *v = cell.vertex(i);
-    for (size_t j = 0; j < dimensions; ++j) {
-      vertices[i][j] = vertexData[v->index()][j];
-      mean[j] += vertexData[v->index()][j];
-    }
-  }
-
-  for (size_t i = 0; i < dimensions; ++i) {
-    mean[i] /= numberOfVertices;
-  }
-
-  // Subtract mean from data to get an expectation value equal to zero.
-
-  for (size_t i = 0; i < numberOfVertices; ++i) {
-    for (size_t j = 0; j < dimensions; ++j) {
-      vertices[i][j] -= mean[j];
-    }
-  }
-
-  // Calculate the correlation matrix.
-
-  DataMatrix R(dimensions);
-
-  for (size_t i = 0; i < dimensions; ++i) {
-    R[i].resize(dimensions);
-    for (size_t j = 0; j < dimensions; ++j) {
-      R[i][j] = 0.0;
-    }
-  }
-
-  for (size_t k = 0; k < dimensions; ++k) {
-    for (size_t l = 0; l < dimensions; ++l) {
-      for (size_t i = 0; i < numberOfVertices; ++i) {
-        R[k][l] += vertices[i][k] * vertices[i][l];
-      }
-      R[k][l] /= numberOfVertices;
-    }
-  }
-
-  // Find the eigenvectors with the two greatests corresponding eigenvalues.
-
-  DataMatrix candidates;
-
-  DataMatrix V;
-  std::vector<double> d;
-
-  myMath::jacobiTransformation(R, V, d);
-
-  size_t max = d.size();
-
-  for (size_t i = 0; i < d.size(); ++i) {
-    if (std::abs(d[i]) >= std::abs(d[max])) {
-      max = i;
-    }
-  }
-
-  return V[max];
+  // Largest eigenvector of the vertex covariance, solved in closed form
+  return CellShape::mainAxis(cell, vertexData);
 }
 
 VolumeRandomDirectionGiantCells::VolumeRandomDirectionGiantCells(
@@ -6501,9 +6296,11 @@ void VolumeRandomDirectionGiantCells::update(
   size_t numWallTmp = wallData.size();
   assert(numWallTmp == T->numWall());
   // Divide
+  CompartmentProfile::startDivideCell();
   T->divideCell(divCell, wI[0], wI[1], v1Pos, v2Pos, cellData, wallData,
                 vertexData, cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
                 parameter(2));
+  CompartmentProfile::stopDivideCell();
 
   const size_t daughterIndex = T->numCell() - 1;
 
@@ -6597,6 +6394,7 @@ void ShortestPathGiantCells::update(Tissue *T, size_t i, DataMatrix &cellData,
                     wallDerivs, vertexDerivs);
 
   if (candidates.size() == 0) {
+    CompartmentProfile::emptyCandidates();
     return;
   }
 
@@ -6624,9 +6422,11 @@ void ShortestPathGiantCells::update(Tissue *T, size_t i, DataMatrix &cellData,
   q[0] = winner.qx;
   q[1] = winner.qy;
 
+  CompartmentProfile::startDivideCell();
   T->divideCell(&cell, winner.wall1, winner.wall2, p, q, cellData, wallData,
                 vertexData, cellDerivs, wallDerivs, vertexDerivs,
                 variableIndex(0), parameter(2));
+  CompartmentProfile::stopDivideCell();
 
   const size_t daughterIndex = T->numCell() - 1;
 
@@ -6839,7 +6639,7 @@ ShortestPathGiantCells::getCandidates(Tissue *T, size_t i, DataMatrix &cellData,
       //   			std::cerr << " distance = " << distance <<
       //   std::endl;
 
-      if (tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0) {
+      if (CompartmentProfile::rejected(tp <= 0.0 || tp >= 1.0 || sp <= 0.0 || sp >= 1.0)) {
         //   				std::cerr << "Discard" << std::endl;
         continue;
       } else {
@@ -7012,9 +6812,11 @@ void FlagResetViaLongestWall::update(Tissue *T, size_t i, DataMatrix &cellData,
   size_t numWallTmp = wallData.size();
   assert(numWallTmp == T->numWall());
   // Divide
+  CompartmentProfile::startDivideCell();
   T->divideCell(divCell, wI, w3I, v1Pos, v2Pos, cellData, wallData, vertexData,
                 cellDeriv, wallDeriv, vertexDeriv, variableIndex(0),
                 parameter(2));
+  CompartmentProfile::stopDivideCell();
   assert(numWallTmp + 3 == T->numWall());
 
   // Change length of new wall between the divided daugther cells
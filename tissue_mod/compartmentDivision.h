@@ -13,6 +13,7 @@
 
 #include "tissue.h"
 #include "baseCompartmentChange.h"
+#include "divisionScheduler.h"
 
 ///
 /// @brief Namespace for classes describing cell division rules.
@@ -321,7 +322,18 @@ namespace Division {
   /// @brief Divides a cell when volume above a threshold
   /// Divides a cell when volume above a threshold. New wall is created
   ///  prependicular to maximal strain rate.
-  
+  ///
+  /// @verbatim
+  /// Division::VolumeViaStrain 4(5) 1 [1]
+  /// V_th LWall_frac LWall_threshold Parallell_flag [buffer_flag]
+  /// I1
+  /// @endverbatim
+  ///
+  /// The strain rate is fitted to the velocities of the cell vertices, from the full tissue
+  /// derivatives evaluated at each division. If buffer_flag is 1, the velocities are instead
+  /// read from the vertex derivatives of the last solver evaluation, and the tissue is only
+  /// evaluated when these are missing for the cell (all zero, e.g. before the first step).
+  ///
   class VolumeViaStrain : public BaseCompartmentChange {
     
   public:
@@ -580,9 +592,34 @@ namespace Division {
     double f(double a, double sigma, double A, double B);
   };
   
-  
+  ///
+  /// @brief Divides a cell (in 2D) along the shortest path, at a volume threshold or at
+  /// random.
+  ///
+  /// @details As ShortestPath2D, but a cell above half the threshold volume divides with
+  /// probability RandDivFreq per check, and the division is placed at random with
+  /// probability RandDivLocFreq. With the optional seventh parameter set to 1, volumes are
+  /// only calculated when a cell is predicted to reach the threshold (DivisionScheduler), and
+  /// the checks of the random divisions are sampled from the geometric distribution. In a
+  /// model file, the reaction is given by
+  /// @verbatim
+  /// Division::ShortestPath2DRandomized 6(7) 1(2) 1 (1)
+  /// V_threshold
+  /// Lwall_fraction
+  /// Lwall_threshold
+  /// COM (1 = COM, 0 = Random)
+  /// RandDivFreq
+  /// RandDivLocFreq
+  /// (schedule_flag)
+  /// volume index
+  /// (time index)
+  /// @endverbatim
+  ///
   class ShortestPath2DRandomized : public BaseCompartmentChange
   {
+  private:
+    DivisionScheduler scheduler_;
+    
   public:
     struct Candidate {
       double distance;
@@ -690,6 +727,32 @@ namespace Division {
     double f(double a, double sigma, double A, double B);
   };
 
+  ///
+  /// @brief Cell-local copy of the vertex positions of a 3D cell, projected to the plane
+  /// perpendicular to the averaged cell normal.
+  ///
+  /// @details Used by the shortest path divisions to run the 2D candidate search on curved
+  /// surfaces without rotating the cell in the tissue vertexData. Positions are read as
+  /// positions[vertexIndex][d] (same as for vertexData) for the vertices of the cell, and
+  /// points found in the plane are rotated back by toTissue().
+  ///
+  class ProjectedCellPositions {
+  public:
+    ProjectedCellPositions(Cell &cell, const DataMatrix &vertexData);
+    
+    const std::vector<double>& operator[](size_t vertexIndex) const;
+    
+    /// @brief Rotates a point of the projection plane back to tissue coordinates.
+    std::vector<double> toTissue(double x, double y) const;
+    
+  private:
+    size_t cellIndex_;
+    std::vector<size_t> vertexIndex_;
+    DataMatrix position_;
+    std::vector<double> center_;
+    double rot_[3][3];
+  };
+
   ///
   /// @brief Divides a cell along the shortest path through center of mass (or random point).
   ///
@@ -759,14 +822,16 @@ namespace Division {
 		DataMatrix &wallDerivs,
 		DataMatrix &vertexDerivs);  
     
+    ///
+    /// @brief Candidate walls and positions for the new wall, searched in the xy-plane.
+    ///
+    /// Positions is the tissue vertexData (2D) or a ProjectedCellPositions (3D), such that
+    /// no tissue data is modified before the division itself.
+    ///
+    template<class Positions>
     std::vector<ShortestPath::Candidate> 
       getCandidates(Tissue* T, size_t i,
-		    DataMatrix &cellData,
-		    DataMatrix &wallData,
-		    DataMatrix &vertexData,
-		    DataMatrix &cellDerivs,
-		    DataMatrix &wallDerivs,
-		    DataMatrix &vertexDerivs);
+		    Positions &vertexData);
     
     double astar(double sigma, double A, double B);
     double f(double a, double sigma, double A, double B);
@@ -843,14 +908,11 @@ namespace Division {
 		DataMatrix &wallDerivs,
 		DataMatrix &vertexDerivs);  
     
+    /// @see ShortestPath::getCandidates()
+    template<class Positions>
     std::vector<STAViaShortestPath::Candidate> 
       getCandidates(Tissue* T, size_t i,
-		    DataMatrix &cellData,
-		    DataMatrix &wallData,
-		    DataMatrix &vertexData,
-		    DataMatrix &cellDerivs,
-		    DataMatrix &wallDerivs,
-		    DataMatrix &vertexDerivs);
+		    Positions &vertexData);
     
     double astar(double sigma, double A, double B);
     double f(double a, double sigma, double A, double B);
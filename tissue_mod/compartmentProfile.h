@@ -0,0 +1,212 @@
+//
+// Filename     : compartmentProfile.h
+// Description  : Per-rule timing and counters for compartment changes, exported as JSON
+// Revision     : $Id:$
+//
+#ifndef COMPARTMENTPROFILE_H
+#define COMPARTMENTPROFILE_H
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+///
+/// @brief Per-rule profile of the compartment change hot paths.
+///
+/// For each rule the number of flag() calls and hits, and the time spent in flag() and
+/// update() are recorded, the latter also as histograms over log2 of the number of ticks
+/// per call. Inside the division rules, the wall pairs evaluated as candidates and rejected
+/// because the new vertices fall outside the walls (tp/sp outside (0,1)), the empty
+/// candidate warnings, and the time in Tissue::divideCell() are counted for the rule
+/// currently updated.
+///
+/// Times are read from the time stamp counter where available (steady_clock otherwise) and
+/// converted to seconds from the counter rate measured over the run.
+///
+/// Profiling is switched on by setting the environment variable TISSUE_PROFILE to an output
+/// file name. The profile is written as JSON at exit and, if TISSUE_PROFILE_INTERVAL is set,
+/// every TISSUE_PROFILE_INTERVAL checks (sweeps of the first rule over the cells). When
+/// switched off, ObservedCompartmentChange calls the rules directly and the counters in the
+/// rules reduce to a test of a null pointer.
+///
+/// @see ObservedCompartmentChange
+///
+class CompartmentProfile {
+
+ public:
+
+  enum { numBin = 48 };
+
+  struct Timer {
+    unsigned long long numCall;
+    unsigned long long ticks;
+    unsigned long long histogram[numBin];
+  };
+
+  struct Rule {
+    std::string id;
+    unsigned long long numFlagHit;
+    unsigned long long numCandidate, numRejected, numEmpty;
+    Timer flag, update, divideCell;
+    unsigned long long divideCellStart;
+  };
+
+  ///
+  /// @brief Returns the profile shared by all observed rules, or 0 if not switched on.
+  ///
+  static CompartmentProfile* instance() {
+    static CompartmentProfile *profile = create();
+    return profile;
+  }
+
+  ///
+  /// @brief Rule currently in flag() or update(), or 0.
+  ///
+  static Rule*& current() {
+    static Rule *rule = 0;
+    return rule;
+  }
+
+  static unsigned long long ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+      (std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  static void add(Timer &timer, unsigned long long numTick) {
+    ++timer.numCall;
+    timer.ticks += numTick;
+    size_t bin = 0;
+    while (numTick >>= 1)
+      ++bin;
+    ++timer.histogram[bin < numBin ? bin : numBin-1];
+  }
+
+  ///
+  /// @brief Counts a candidate wall pair, and returns (and counts) the rejection flag.
+  ///
+  static bool rejected(bool reject) {
+    Rule *rule = current();
+    if (rule) {
+      ++rule->numCandidate;
+      rule->numRejected += reject;
+    }
+    return reject;
+  }
+
+  static void emptyCandidates() {
+    if (current())
+      ++current()->numEmpty;
+  }
+
+  static void startDivideCell() {
+    if (current())
+      current()->divideCellStart = ticks();
+  }
+
+  static void stopDivideCell() {
+    if (current())
+      add(current()->divideCell, ticks()-current()->divideCellStart);
+  }
+
+  size_t addRule(const std::string &idValue) {
+    Rule rule = Rule();
+    rule.id = idValue;
+    rule_.push_back(rule);
+    return rule_.size()-1;
+  }
+
+  Rule& rule(size_t k) { return rule_[k]; }
+
+  ///
+  /// @brief Counts the checks (flag() of the first rule for cell 0) and writes the profile
+  /// every interval checks.
+  ///
+  void check(size_t ruleIndex, size_t i) {
+    if (ruleIndex == 0 && i == 0 && interval_ && ++numCheck_ % interval_ == 0)
+      print();
+  }
+
+  ///
+  /// @brief Writes the profile as JSON, replacing the previous one.
+  ///
+  void print() {
+    std::ofstream OUT(fileName_.c_str());
+    if (!OUT) {
+      std::cerr << "CompartmentProfile::print() Cannot open file " << fileName_ << std::endl;
+      return;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime_;
+    double tickRate = elapsed.count() > 0.0 ? (ticks()-startTick_)/elapsed.count() : 1.0;
+    OUT << "{\n  \"seconds\": " << elapsed.count()
+	<< ",\n  \"ticksPerSecond\": " << tickRate
+	<< ",\n  \"numCheck\": " << numCheck_
+	<< ",\n  \"histogram\": \"calls per floor(log2(ticks))\""
+	<< ",\n  \"rules\": [";
+    for (size_t k=0; k<rule_.size(); ++k) {
+      const Rule &r = rule_[k];
+      OUT << (k ? "," : "") << "\n    {\n      \"id\": \"" << r.id << "\""
+	  << ",\n      \"flagHits\": " << r.numFlagHit
+	  << ",\n      \"flagHitRate\": "
+	  << (r.flag.numCall ? double(r.numFlagHit)/r.flag.numCall : 0.0)
+	  << ",\n      \"candidates\": " << r.numCandidate
+	  << ",\n      \"rejectedCandidates\": " << r.numRejected
+	  << ",\n      \"emptyCandidateWarnings\": " << r.numEmpty;
+      printTimer(OUT, "flag", r.flag, tickRate);
+      printTimer(OUT, "update", r.update, tickRate);
+      printTimer(OUT, "divideCell", r.divideCell, tickRate);
+      OUT << "\n    }";
+    }
+    OUT << "\n  ]\n}" << std::endl;
+  }
+
+ private:
+
+  CompartmentProfile(const char *fileName, size_t intervalValue)
+    : fileName_(fileName), interval_(intervalValue), numCheck_(0),
+      startTime_(std::chrono::steady_clock::now()), startTick_(ticks()) {}
+
+  static CompartmentProfile* create() {
+    const char *fileName = std::getenv("TISSUE_PROFILE");
+    if (!fileName || !*fileName)
+      return 0;
+    const char *interval = std::getenv("TISSUE_PROFILE_INTERVAL");
+    CompartmentProfile *profile =
+      new CompartmentProfile(fileName, interval ? std::atoi(interval) : 0);
+    std::atexit(printAtExit);
+    return profile;
+  }
+
+  static void printAtExit() { instance()->print(); }
+
+  static void printTimer(std::ostream &OUT, const char *name, const Timer &timer,
+			 double tickRate) {
+    size_t numUsed = numBin;
+    while (numUsed && !timer.histogram[numUsed-1])
+      --numUsed;
+    OUT << ",\n      \"" << name << "\": {\"calls\": " << timer.numCall
+	<< ", \"seconds\": " << timer.ticks/tickRate << ", \"histogram\": [";
+    for (size_t b=0; b<numUsed; ++b)
+      OUT << (b ? ", " : "") << timer.histogram[b];
+    OUT << "]}";
+  }
+
+  std::string fileName_;
+  size_t interval_;
+  size_t numCheck_;
+  std::chrono::steady_clock::time_point startTime_;
+  unsigned long long startTick_;
+  std::vector<Rule> rule_;
+};
+
+#endif
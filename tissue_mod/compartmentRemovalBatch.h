@@ -0,0 +1,102 @@
+//
+// Filename     : compartmentRemovalBatch.h
+// Description  : Batched cell removal at the end of a sweep
+// Revision     : $Id:$
+//
+#ifndef COMPARTMENTREMOVALBATCH_H
+#define COMPARTMENTREMOVALBATCH_H
+
+#include <algorithm>
+#include <vector>
+
+#include "tissue.h"
+#include "baseCompartmentChange.h"
+
+///
+/// @brief Batched mode of a removal rule: the cells flagged by the rule during a sweep over
+/// the cells are collected, and removed together when the last cell has been checked.
+///
+/// @details For the rules removing only the flagged cell (RemovalIndex, RemovalOutsideRadius
+/// and RemovalOutsidePosition), whose flag() does not depend on the removal of other cells.
+/// All cells are flagged on the tissue as it was at the start of the sweep, and are then
+/// removed by Tissue::removeCell(), as by the rules themselves, from the highest index down
+/// such that the indices of the cells left to remove stay valid.
+///
+/// In a model file, the rule is given by its name prefixed by Batched::, with the parameters
+/// and variable indices of the rule, e.g.
+/// @verbatim
+/// Batched::RemovalOutsideRadius 1 0
+/// R
+/// @endverbatim
+///
+class BatchedRemoval : public BaseCompartmentChange {
+
+ public:
+
+  BatchedRemoval(BaseCompartmentChange *rule)
+    : rule_(rule), lastCell_(none) {
+    setId("Batched::" + rule->id());
+    setNumChange(rule->numChange());
+    std::vector<double> pVal(rule->numParameter());
+    std::vector<std::string> pId(rule->numParameter());
+    for (size_t k=0; k<pVal.size(); ++k) {
+      pVal[k] = rule->parameter(k);
+      pId[k] = rule->parameterId(k);
+    }
+    setParameter(pVal);
+    setParameterId(pId);
+    std::vector< std::vector<size_t> > varIndexVal(rule->numVariableIndexLevel());
+    for (size_t l=0; l<varIndexVal.size(); ++l)
+      for (size_t k=0; k<rule->numVariableIndex(l); ++k)
+	varIndexVal[l].push_back(rule->variableIndex(l,k));
+    setVariableIndex(varIndexVal);
+  }
+
+  ~BatchedRemoval() { delete rule_; }
+
+  ///
+  /// @brief Collects cell i if flagged by the rule, and flags the last cell of the sweep if
+  /// any cell has been collected.
+  ///
+  int flag(Tissue *T,size_t i,
+	   DataMatrix &cellData,
+	   DataMatrix &wallData,
+	   DataMatrix &vertexData,
+	   DataMatrix &cellDerivs,
+	   DataMatrix &wallDerivs,
+	   DataMatrix &vertexDerivs ) {
+    if (lastCell_ == none || i <= lastCell_)
+      flagged_.clear();
+    lastCell_ = i;
+    for (size_t k=0; k<numParameter(); ++k)
+      rule_->parameterAddress(k) = parameter(k);
+    if (rule_->flag(T,i,cellData,wallData,vertexData,cellDerivs,wallDerivs,vertexDerivs))
+      flagged_.push_back(i);
+    return !flagged_.empty() && i+1 == T->numCell();
+  }
+
+  void update(Tissue* T,size_t i,
+	      DataMatrix &cellData,
+	      DataMatrix &wallData,
+	      DataMatrix &vertexData,
+	      DataMatrix &cellDerivs,
+	      DataMatrix &wallDerivs,
+	      DataMatrix &vertexDerivs ) {
+    std::sort(flagged_.begin(), flagged_.end());
+    for (size_t k=flagged_.size(); k>0; --k)
+      T->removeCell(flagged_[k-1], cellData, wallData, vertexData, cellDerivs, wallDerivs,
+		    vertexDerivs);
+    flagged_.clear();
+    lastCell_ = none;
+  }
+
+ private:
+
+  static const size_t none = static_cast<size_t>(-1);
+
+  BaseCompartmentChange *rule_;
+  std::vector<size_t> flagged_;
+  size_t lastCell_;
+};
+
+#endif
@@ -0,0 +1,390 @@
+//
+// Filename     : compartmentStatistics.h
+// Description  : Running tissue statistics updated by compartment change events
+// Revision     : $Id:$
+//
+#ifndef COMPARTMENTSTATISTICS_H
+#define COMPARTMENTSTATISTICS_H
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tissue.h"
+#include "baseCompartmentChange.h"
+#include "checkpoint.h"
+#include "compartmentChangeJournal.h"
+#include "compartmentProfile.h"
+#include "divisionRecord.h"
+
+///
+/// @brief Running tissue topology statistics, updated at each division/removal event.
+///
+/// Keeps a cell sidedness (number of walls) histogram, the mean and variance of the length
+/// of the walls created by divisions, and the number of divisions and removals per rule. The
+/// statistics are updated locally from the cells and walls touched by an event, i.e. the
+/// divided cell, its daughter and the neighbours across the two split walls, so no pass over
+/// the tissue and no mesh I/O is needed. The full tissue is only visited once, when the
+/// histogram is initiated at the first event.
+///
+/// Statistics are switched on by setting the environment variable TISSUE_STATISTICS to an
+/// output file name. A row is written every TISSUE_STATISTICS_INTERVAL events (default 1):
+///
+/// @verbatim
+/// event numCell meanSide varSide meanDivWall varDivWall n_3 ... n_12 n_13+ div_<rule> ... rem_<rule> ...
+/// @endverbatim
+///
+/// Removals are assumed to keep the sidedness of the neighbours (Tissue attaches the shared
+/// walls to the background), i.e. only the removed cell leaves the histogram.
+///
+/// @see ObservedCompartmentChange
+///
+class CompartmentStatistics {
+
+ public:
+
+  enum { maxSide = 13 };
+
+  ///
+  /// @brief Returns the statistics shared by all observed rules, or 0 if not switched on.
+  ///
+  static CompartmentStatistics* instance() {
+    static CompartmentStatistics *stat = create();
+    return stat;
+  }
+
+  size_t addRule(const std::string &idValue) {
+    ruleId_.push_back(idValue);
+    numDivision_.push_back(0);
+    numRemoval_.push_back(0);
+    return ruleId_.size()-1;
+  }
+
+  ///
+  /// @brief Stores the sizes and the sidedness of cell i before a rule update.
+  ///
+  void beforeUpdate(Tissue *T, size_t i) {
+    if (!initiated_)
+      initiate(T);
+    numCellOld_ = T->numCell();
+    numVertexOld_ = T->numVertex();
+    numSideOld_ = T->cell(i).numWall();
+  }
+
+  ///
+  /// @brief Updates the statistics from the cells and walls touched by the update of cell i.
+  ///
+  void afterUpdate(Tissue *T, size_t i, size_t ruleIndex, DataMatrix &vertexData) {
+
+    if (T->numCell() == numCellOld_+1 && T->numVertex() == numVertexOld_+2) {
+      // Division: cell i and its daughter replace the mother, and the neighbours
+      // across the two split walls gain one wall each
+      size_t daughter = T->numCell()-1;
+      removeSide(numSideOld_);
+      addSide(T->cell(i).numWall());
+      addSide(T->cell(daughter).numWall());
+
+      Vertex *v1 = &(T->vertex(T->numVertex()-2));
+      Vertex *v2 = &(T->vertex(T->numVertex()-1));
+      Cell *c1 = neighbour(T, v1, i, daughter);
+      Cell *c2 = neighbour(T, v2, i, daughter);
+      if (c1 && c1 == c2) {
+	removeSide(c1->numWall()-2);
+	addSide(c1->numWall());
+      }
+      else {
+	if (c1) {
+	  removeSide(c1->numWall()-1);
+	  addSide(c1->numWall());
+	}
+	if (c2) {
+	  removeSide(c2->numWall()-1);
+	  addSide(c2->numWall());
+	}
+      }
+
+      // Welford update with the new wall between the two new vertices
+      double length = 0.0;
+      for (size_t d=0; d<vertexData[v1->index()].size(); ++d) {
+	double dx = vertexData[v2->index()][d] - vertexData[v1->index()][d];
+	length += dx*dx;
+      }
+      length = std::sqrt(length);
+      ++numDivisionWall_;
+      double delta = length - divisionWallMean_;
+      divisionWallMean_ += delta/numDivisionWall_;
+      divisionWallM2_ += delta*(length - divisionWallMean_);
+
+      ++numDivision_[ruleIndex];
+    }
+    else if (T->numCell()+1 == numCellOld_) {
+      removeSide(numSideOld_);
+      ++numRemoval_[ruleIndex];
+    }
+    else if (T->numCell() != numCellOld_) {
+      // Not a single division or removal, fall back to a full recount
+      initiate(T);
+      if (T->numCell() > numCellOld_)
+	++numDivision_[ruleIndex];
+      else
+	++numRemoval_[ruleIndex];
+    }
+    else
+      return;
+
+    if (++numEvent_ % interval_ == 0)
+      print();
+  }
+
+  ///
+  /// @brief Writes one row of the statistics time series.
+  ///
+  void print() {
+    if (!headerPrinted_) {
+      OUT_ << "event numCell meanSide varSide meanDivWall varDivWall";
+      for (size_t s=3; s<maxSide; ++s)
+	OUT_ << " n_" << s;
+      OUT_ << " n_" << maxSide << "+";
+      for (size_t r=0; r<ruleId_.size(); ++r)
+	OUT_ << " div_" << ruleId_[r];
+      for (size_t r=0; r<ruleId_.size(); ++r)
+	OUT_ << " rem_" << ruleId_[r];
+      OUT_ << std::endl;
+      headerPrinted_ = 1;
+    }
+    double mean = numCell_ ? sideSum_/numCell_ : 0.0;
+    double var = numCell_ ? sideSum2_/numCell_ - mean*mean : 0.0;
+    OUT_ << numEvent_ << " " << numCell_ << " " << mean << " " << var << " "
+	 << divisionWallMean_ << " "
+	 << (numDivisionWall_>1 ? divisionWallM2_/(numDivisionWall_-1) : 0.0);
+    for (size_t s=3; s<=maxSide; ++s)
+      OUT_ << " " << sideHistogram_[s];
+    for (size_t r=0; r<numDivision_.size(); ++r)
+      OUT_ << " " << numDivision_[r];
+    for (size_t r=0; r<numRemoval_.size(); ++r)
+      OUT_ << " " << numRemoval_[r];
+    OUT_ << std::endl;
+  }
+
+ private:
+
+  CompartmentStatistics(const char *fileName, size_t intervalValue)
+    : OUT_(fileName), interval_(intervalValue ? intervalValue : 1), numEvent_(0),
+      initiated_(0), headerPrinted_(0), sideHistogram_(maxSide+1, 0), numCell_(0),
+      sideSum_(0.0), sideSum2_(0.0), numDivisionWall_(0), divisionWallMean_(0.0),
+      divisionWallM2_(0.0), numCellOld_(0), numVertexOld_(0),
+      numSideOld_(0) {
+    if (!OUT_) {
+      std::cerr << "CompartmentStatistics::CompartmentStatistics() "
+		<< "Cannot open file " << fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  static CompartmentStatistics* create() {
+    const char *fileName = std::getenv("TISSUE_STATISTICS");
+    if (!fileName || !*fileName)
+      return 0;
+    const char *interval = std::getenv("TISSUE_STATISTICS_INTERVAL");
+    long intervalValue = 1;
+    if (interval && *interval) {
+      char *end;
+      intervalValue = std::strtol(interval, &end, 10);
+      if (*end || intervalValue < 1) {
+	std::cerr << "CompartmentStatistics::create() "
+		  << "TISSUE_STATISTICS_INTERVAL must be a number of events >= 1, not "
+		  << interval << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+    return new CompartmentStatistics(fileName, size_t(intervalValue));
+  }
+
+  void initiate(Tissue *T) {
+    sideHistogram_.assign(maxSide+1, 0);
+    numCell_ = 0;
+    sideSum_ = sideSum2_ = 0.0;
+    for (size_t i=0; i<T->numCell(); ++i)
+      addSide(T->cell(i).numWall());
+    initiated_ = 1;
+  }
+
+  void addSide(size_t numSide) {
+    ++sideHistogram_[numSide<maxSide ? numSide : size_t(maxSide)];
+    ++numCell_;
+    sideSum_ += numSide;
+    sideSum2_ += double(numSide)*numSide;
+  }
+
+  void removeSide(size_t numSide) {
+    --sideHistogram_[numSide<maxSide ? numSide : size_t(maxSide)];
+    --numCell_;
+    sideSum_ -= numSide;
+    sideSum2_ -= double(numSide)*numSide;
+  }
+
+  ///
+  /// @brief Returns the cell across the split wall at a new vertex, or 0 at the boundary.
+  ///
+  Cell* neighbour(Tissue *T, Vertex *v, size_t i, size_t daughter) {
+    for (size_t k=0; k<v->numWall(); ++k) {
+      Wall *w = v->wall(k);
+      Cell *c = w->cell1();
+      if (c == &(T->cell(i)) || c == &(T->cell(daughter)))
+	c = w->cell2();
+      if (c != T->background() && c != &(T->cell(i)) && c != &(T->cell(daughter)))
+	return c;
+    }
+    return 0;
+  }
+
+  std::ofstream OUT_;
+  size_t interval_;
+  size_t numEvent_;
+  int initiated_;
+  int headerPrinted_;
+
+  std::vector<size_t> sideHistogram_;
+  size_t numCell_;
+  double sideSum_, sideSum2_;
+
+  size_t numDivisionWall_;
+  double divisionWallMean_, divisionWallM2_;
+
+  std::vector<std::string> ruleId_;
+  std::vector<size_t> numDivision_;
+  std::vector<size_t> numRemoval_;
+
+  size_t numCellOld_, numVertexOld_, numSideOld_;
+};
+
+///
+/// @brief Wraps a compartment change rule and reports its events to the
+/// CompartmentChangeJournal, CompartmentStatistics, CompartmentProfile and DivisionRecorder.
+///
+/// Created by BaseCompartmentChange::createCompartmentChange() for every rule read from a
+/// model file, such that the journal sees the changes of all rules also when its consumers
+/// (e.g. the DivisionScheduler of a later rule) are registered after a rule is created.
+/// Solver steps are counted for the Checkpoint before each flag().
+///
+/// The parameters and their ids are copied from the rule. Since the parameter accessors are
+/// not virtual, the copies are written to the rule before each flag() and update(), and read
+/// back after each update(), such that parameters set through the wrapper (e.g. by
+/// optimizers holding parameterAddress()) are used by the rule.
+///
+class ObservedCompartmentChange : public BaseCompartmentChange {
+
+ public:
+
+  ///
+  /// @brief Returns rule wrapped in an observer.
+  ///
+  static BaseCompartmentChange* observe(BaseCompartmentChange *rule) {
+    if (!rule)
+      return rule;
+    return new ObservedCompartmentChange(rule, CompartmentStatistics::instance(),
+					 CompartmentProfile::instance());
+  }
+
+  ~ObservedCompartmentChange() { delete rule_; }
+
+  int flag(Tissue *T,size_t i,
+	   DataMatrix &cellData,
+	   DataMatrix &wallData,
+	   DataMatrix &vertexData,
+	   DataMatrix &cellDerivs,
+	   DataMatrix &wallDerivs,
+	   DataMatrix &vertexDerivs ) {
+    Checkpoint::instance().visit(this,*T,i,cellData,wallData,vertexData,cellDerivs,
+				 wallDerivs,vertexDerivs);
+    setRuleParameter();
+    if (!profile_)
+      return rule_->flag(T,i,cellData,wallData,vertexData,cellDerivs,wallDerivs,vertexDerivs);
+    profile_->check(profileIndex_,i);
+    CompartmentProfile::Rule &rule = profile_->rule(profileIndex_);
+    CompartmentProfile::Rule *previous = CompartmentProfile::current();
+    CompartmentProfile::current() = &rule;
+    unsigned long long start = CompartmentProfile::ticks();
+    int flag = rule_->flag(T,i,cellData,wallData,vertexData,cellDerivs,wallDerivs,vertexDerivs);
+    CompartmentProfile::add(rule.flag, CompartmentProfile::ticks()-start);
+    CompartmentProfile::current() = previous;
+    if (flag)
+      ++rule.numFlagHit;
+    return flag;
+  }
+
+  void update(Tissue* T,size_t i,
+	      DataMatrix &cellData,
+	      DataMatrix &wallData,
+	      DataMatrix &vertexData,
+	      DataMatrix &cellDerivs,
+	      DataMatrix &wallDerivs,
+	      DataMatrix &vertexDerivs ) {
+    setRuleParameter();
+    CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+    journal.beforeUpdate(T);
+    if (stat_)
+      stat_->beforeUpdate(T,i);
+    DivisionRecorder *recorder = DivisionRecorder::instance();
+    if (recorder)
+      recorder->beforeUpdate(rule_,T,i,cellData,wallData,vertexData);
+    if (profile_) {
+      CompartmentProfile::Rule &rule = profile_->rule(profileIndex_);
+      CompartmentProfile::Rule *previous = CompartmentProfile::current();
+      CompartmentProfile::current() = &rule;
+      unsigned long long start = CompartmentProfile::ticks();
+      rule_->update(T,i,cellData,wallData,vertexData,cellDerivs,wallDerivs,vertexDerivs);
+      CompartmentProfile::add(rule.update, CompartmentProfile::ticks()-start);
+      CompartmentProfile::current() = previous;
+    }
+    else
+      rule_->update(T,i,cellData,wallData,vertexData,cellDerivs,wallDerivs,vertexDerivs);
+    for (size_t k=0; k<numParameter(); ++k)
+      parameterAddress(k) = rule_->parameter(k);
+    journal.afterUpdate(T,i);
+    if (recorder)
+      recorder->afterUpdate(T,vertexData);
+    if (stat_)
+      stat_->afterUpdate(T,i,ruleIndex_,vertexData);
+  }
+
+ private:
+
+  ObservedCompartmentChange(BaseCompartmentChange *rule, CompartmentStatistics *stat,
+			    CompartmentProfile *profile)
+    : rule_(rule), stat_(stat), profile_(profile) {
+    setId(rule->id());
+    setNumChange(rule->numChange());
+    std::vector<double> pVal(rule->numParameter());
+    std::vector<std::string> pId(rule->numParameter());
+    for (size_t k=0; k<pVal.size(); ++k) {
+      pVal[k] = rule->parameter(k);
+      pId[k] = rule->parameterId(k);
+    }
+    setParameter(pVal);
+    setParameterId(pId);
+    std::vector< std::vector<size_t> > varIndexVal(rule->numVariableIndexLevel());
+    for (size_t l=0; l<varIndexVal.size(); ++l)
+      for (size_t k=0; k<rule->numVariableIndex(l); ++k)
+	varIndexVal[l].push_back(rule->variableIndex(l,k));
+    setVariableIndex(varIndexVal);
+    ruleIndex_ = stat_ ? stat_->addRule(rule->id()) : 0;
+    profileIndex_ = profile_ ? profile_->addRule(rule->id()) : 0;
+  }
+
+  void setRuleParameter() {
+    for (size_t k=0; k<numParameter(); ++k)
+      rule_->parameterAddress(k) = parameter(k);
+  }
+
+  BaseCompartmentChange *rule_;
+  CompartmentStatistics *stat_;
+  size_t ruleIndex_;
+  CompartmentProfile *profile_;
+  size_t profileIndex_;
+};
+
+#endif
@@ -0,0 +1,281 @@
+//
+// Filename     : divisionRecord.h
+// Description  : Recording of division events for golden output regression of division rules
+// Revision     : $Id:$
+//
+#ifndef DIVISIONRECORD_H
+#define DIVISIONRECORD_H
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tissue.h"
+#include "baseCompartmentChange.h"
+#include "compartmentChangeJournal.h"
+#include "myRandom.h"
+
+///
+/// @brief One update of a compartment change rule: the rule, the random seed (0 if the
+/// generator was not reseeded), the cell polygon before the update, and the resulting
+/// division.
+///
+/// Vertices are stored in the order of the cell and walls as pairs of local vertex
+/// indices, together with the cell and wall data rows. The result is whether the cell
+/// divided and, for divisions done by Tissue::divideCell(), the end points (before the
+/// update) of the two split walls and the positions of the two new vertices. Records are
+/// written as text with full precision:
+///
+/// @verbatim
+/// record <id>
+/// parameter <n> <values>
+/// variableIndex <numLevel> (<n> <indices>) ...
+/// seed <seed>
+/// vertex <numVertex> <dimension> <positions>
+/// wall <numWall> (<v1> <v2> <n> <wallData>) ...
+/// cell <n> <cellData>
+/// result <divided> <numSplitWall> <end points> <numNewVertex> <positions>
+/// @endverbatim
+///
+/// @see DivisionRecorder, benchmark/divisionReplay.cc
+///
+struct DivisionRecord {
+
+  std::string id;
+  std::vector<double> parameter;
+  std::vector< std::vector<size_t> > variableIndex;
+  long seed;
+  DataMatrix vertex;
+  std::vector<size_t> wallVertex;
+  DataMatrix wall;
+  std::vector<double> cell;
+  int divided;
+  DataMatrix splitWall;  ///< 2*dimension end point coordinates per split wall
+  DataMatrix newVertex;
+
+  void write(std::ostream &OUT) const {
+    OUT.precision(17);
+    OUT << "record " << id << "\nparameter " << parameter.size();
+    for (size_t k=0; k<parameter.size(); ++k)
+      OUT << " " << parameter[k];
+    OUT << "\nvariableIndex " << variableIndex.size();
+    for (size_t l=0; l<variableIndex.size(); ++l) {
+      OUT << " " << variableIndex[l].size();
+      for (size_t k=0; k<variableIndex[l].size(); ++k)
+	OUT << " " << variableIndex[l][k];
+    }
+    OUT << "\nseed " << seed << "\nvertex " << vertex.size() << " "
+	<< (vertex.size() ? vertex[0].size() : 0);
+    for (size_t v=0; v<vertex.size(); ++v)
+      writeRow(OUT, vertex[v], 0);
+    OUT << "\nwall " << wall.size();
+    for (size_t w=0; w<wall.size(); ++w) {
+      OUT << "\n" << wallVertex[2*w] << " " << wallVertex[2*w+1];
+      writeRow(OUT, wall[w], 1);
+    }
+    OUT << "\ncell";
+    writeRow(OUT, cell, 1);
+    OUT << "\nresult " << divided << " " << splitWall.size();
+    for (size_t w=0; w<splitWall.size(); ++w)
+      writeRow(OUT, splitWall[w], 0);
+    OUT << " " << newVertex.size();
+    for (size_t v=0; v<newVertex.size(); ++v)
+      writeRow(OUT, newVertex[v], 0);
+    OUT << std::endl;
+  }
+
+  ///
+  /// @brief Reads the next record, returning 0 at the end of the stream.
+  ///
+  int read(std::istream &IN) {
+    std::string tag;
+    if (!(IN >> tag))
+      return 0;
+    size_t n, m, dimension;
+    IN >> id;
+    IN >> tag >> n;
+    parameter.resize(n);
+    for (size_t k=0; k<n; ++k)
+      IN >> parameter[k];
+    IN >> tag >> n;
+    variableIndex.resize(n);
+    for (size_t l=0; l<n; ++l) {
+      IN >> m;
+      variableIndex[l].resize(m);
+      for (size_t k=0; k<m; ++k)
+	IN >> variableIndex[l][k];
+    }
+    IN >> tag >> seed;
+    IN >> tag >> n >> dimension;
+    vertex.assign(n, std::vector<double>(dimension));
+    for (size_t v=0; v<n; ++v)
+      for (size_t d=0; d<dimension; ++d)
+	IN >> vertex[v][d];
+    IN >> tag >> n;
+    wallVertex.resize(2*n);
+    wall.resize(n);
+    for (size_t w=0; w<n; ++w) {
+      IN >> wallVertex[2*w] >> wallVertex[2*w+1];
+      readRow(IN, wall[w]);
+    }
+    IN >> tag;
+    readRow(IN, cell);
+    IN >> tag >> divided >> n;
+    splitWall.assign(n, std::vector<double>(2*dimension));
+    for (size_t w=0; w<n; ++w)
+      for (size_t d=0; d<2*dimension; ++d)
+	IN >> splitWall[w][d];
+    IN >> n;
+    newVertex.assign(n, std::vector<double>(dimension));
+    for (size_t v=0; v<n; ++v)
+      for (size_t d=0; d<dimension; ++d)
+	IN >> newVertex[v][d];
+    if (!IN) {
+      std::cerr << "DivisionRecord::read() Malformed record for " << id << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return 1;
+  }
+
+ private:
+
+  static void writeRow(std::ostream &OUT, const std::vector<double> &row, int withSize) {
+    if (withSize)
+      OUT << " " << row.size();
+    for (size_t k=0; k<row.size(); ++k)
+      OUT << " " << row[k];
+  }
+
+  static void readRow(std::istream &IN, std::vector<double> &row) {
+    size_t n;
+    IN >> n;
+    row.resize(n);
+    for (size_t k=0; k<n; ++k)
+      IN >> row[k];
+  }
+};
+
+///
+/// @brief Records the updates of compartment change rules from real runs, as golden
+/// results for benchmark/divisionReplay.cc.
+///
+/// Switched on by setting the environment variable TISSUE_DIVISION_RECORD to an output file
+/// name; the rules created by BaseCompartmentChange::createCompartmentChange() are then
+/// recorded by ObservedCompartmentChange. Recording does not change the random number
+/// stream, and the records of rules drawing random numbers in update() can then not be
+/// replayed. Setting TISSUE_DIVISION_RECORD_SEED to 1 in addition draws a seed from
+/// myRandom::Rnd() before each update and reseeds the generator with it (the generator state
+/// itself is not accessible), such that all updates can be replayed, at the cost of a run
+/// that differs from one without recording.
+///
+class DivisionRecorder {
+
+ public:
+
+  ///
+  /// @brief Returns the recorder, or 0 if not switched on.
+  ///
+  static DivisionRecorder* instance() {
+    static DivisionRecorder *recorder = create();
+    return recorder;
+  }
+
+  void beforeUpdate(BaseCompartmentChange *rule, Tissue *T, size_t i, DataMatrix &cellData,
+		    DataMatrix &wallData, DataMatrix &vertexData) {
+    record_.id = rule->id();
+    record_.parameter.resize(rule->numParameter());
+    for (size_t k=0; k<rule->numParameter(); ++k)
+      record_.parameter[k] = rule->parameter(k);
+    record_.variableIndex.resize(rule->numVariableIndexLevel());
+    for (size_t l=0; l<rule->numVariableIndexLevel(); ++l) {
+      record_.variableIndex[l].resize(rule->numVariableIndex(l));
+      for (size_t k=0; k<rule->numVariableIndex(l); ++k)
+	record_.variableIndex[l][k] = rule->variableIndex(l,k);
+    }
+
+    Cell &cell = T->cell(i);
+    record_.vertex.resize(cell.numVertex());
+    std::vector<size_t> localIndex(T->numVertex(), 0);
+    for (size_t k=0; k<cell.numVertex(); ++k) {
+      size_t v = cell.vertex(k)->index();
+      record_.vertex[k] = vertexData[v];
+      localIndex[v] = k;
+    }
+    wallIndex_.resize(cell.numWall());
+    record_.wall.resize(cell.numWall());
+    record_.wallVertex.resize(2*cell.numWall());
+    for (size_t k=0; k<cell.numWall(); ++k) {
+      Wall *w = cell.wall(k);
+      wallIndex_[k] = w->index();
+      record_.wall[k] = wallData[w->index()];
+      record_.wallVertex[2*k] = localIndex[w->vertex1()->index()];
+      record_.wallVertex[2*k+1] = localIndex[w->vertex2()->index()];
+    }
+    record_.cell = cellData[i];
+    numCellOld_ = T->numCell();
+
+    record_.seed = 0;
+    if (reseed_) {
+      record_.seed = 1 + long(myRandom::Rnd()*2147483645.0);
+      myRandom::sran3(record_.seed);
+    }
+  }
+
+  void afterUpdate(Tissue *T, DataMatrix &vertexData) {
+    record_.divided = T->numCell() > numCellOld_;
+    record_.splitWall.clear();
+    record_.newVertex.clear();
+    CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+    if (journal.numRecord() > journalRead_ &&
+	journal.record(journal.numRecord()-1).type == CompartmentChangeJournal::division) {
+      const CompartmentChangeJournal::Record &r = journal.record(journal.numRecord()-1);
+      for (size_t k=0; k<2; ++k) {
+	record_.newVertex.push_back(vertexData[r.newVertex[k]]);
+	for (size_t w=0; w<wallIndex_.size(); ++w)
+	  if (wallIndex_[w] == r.splitWall[k]) {
+	    std::vector<double> end(record_.vertex[record_.wallVertex[2*w]]);
+	    const std::vector<double> &end2 = record_.vertex[record_.wallVertex[2*w+1]];
+	    end.insert(end.end(), end2.begin(), end2.end());
+	    record_.splitWall.push_back(end);
+	  }
+      }
+    }
+    journalRead_ = journal.numRecord();
+    journal.consumed(journalConsumer_, journalRead_);
+    record_.write(OUT_);
+  }
+
+ private:
+
+  DivisionRecorder(const char *fileName, int reseed)
+    : OUT_(fileName), reseed_(reseed), numCellOld_(0) {
+    if (!OUT_) {
+      std::cerr << "DivisionRecorder::DivisionRecorder() "
+		<< "Cannot open file " << fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+    journalConsumer_ = journal.addConsumer();
+    journalRead_ = journal.numRecord();
+  }
+
+  static DivisionRecorder* create() {
+    const char *fileName = std::getenv("TISSUE_DIVISION_RECORD");
+    if (!fileName || !*fileName)
+      return 0;
+    const char *seed = std::getenv("TISSUE_DIVISION_RECORD_SEED");
+    return new DivisionRecorder(fileName, seed && std::atoi(seed) != 0);
+  }
+
+  std::ofstream OUT_;
+  int reseed_;
+  DivisionRecord record_;
+  std::vector<size_t> wallIndex_;
+  size_t numCellOld_;
+  size_t journalConsumer_;
+  size_t journalRead_;
+};
+
+#endif
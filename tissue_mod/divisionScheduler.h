@@ -0,0 +1,219 @@
+//
+// Filename     : divisionScheduler.h
+// Description  : Event-driven scheduling of division checks from predicted threshold crossings
+// Revision     : $Id:$
+//
+#ifndef DIVISIONSCHEDULER_H
+#define DIVISIONSCHEDULER_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "tissue.h"
+#include "checkpoint.h"
+#include "compartmentChangeJournal.h"
+#include "myRandom.h"
+
+///
+/// @brief Predicts when cells cross a division threshold such that volumes are only
+/// calculated for cells that are due.
+///
+/// Time is counted in checks: the clock advances each time the cell index visited does not
+/// increase, i.e. at the start of each sweep over the cells. After each volume calculation
+/// the logarithmic growth rate per check is estimated from the previous calculation, and the
+/// cell is scheduled to be checked again after a fraction (safety) of the predicted number of
+/// checks until the threshold is crossed, at most maxSkip checks later. Cells without a
+/// growth estimate (new, just divided, or shrinking) are checked at every check. For
+/// exponential growth (e.g. MoveVertexRadially) the number of volume calculations per cell
+/// and cell cycle is then logarithmic in the cycle length instead of linear.
+///
+/// Random events happening with probability p per check are scheduled by sampling the
+/// number of checks to the next event from the geometric distribution, which gives the same
+/// event statistics as one Bernoulli draw per cell and check.
+///
+/// Cell indices are kept for divisions (the daughter is appended). Removals give the cells
+/// new indices, and reset all predictions: they are read from the
+/// CompartmentChangeJournal, which records the changes of all compartment change rules, when
+/// the scheduler is registered as a consumer (useJournal()), and a decrease in the number of
+/// cells also resets the predictions for changes made outside the rules. The predictions are saved in checkpoints when the scheduler is added to the
+/// Checkpoint.
+///
+class DivisionScheduler : public CheckpointState {
+
+ public:
+
+  DivisionScheduler(double safety=0.5, size_t maxSkip=50)
+    : safety_(safety), maxSkip_(maxSkip), now_(0), lastCell_(none), numCell_(0),
+      journalConsumer_(none), journalRead_(0) {}
+
+  ///
+  /// @brief Registers the scheduler as a consumer of the CompartmentChangeJournal, to be
+  /// called before the compartment change rules are created.
+  ///
+  void useJournal()
+  {
+    CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+    journalConsumer_ = journal.addConsumer();
+    journalRead_ = journal.numRecord();
+  }
+
+  ///
+  /// @brief Advances the clock when a new sweep over the cells starts and follows changes
+  /// in the number of cells. To be called first for each cell visited.
+  ///
+  void visit(Tissue &T, size_t i)
+  {
+    if (lastCell_ == none || i <= lastCell_)
+      ++now_;
+    lastCell_ = i;
+    size_t numCell = T.numCell();
+    if (journalConsumer_ != none) {
+      CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+      if (journal.numRecord() > journalRead_) {
+	for (size_t k=journalRead_; k<journal.numRecord(); ++k)
+	  if (journal.record(k).type != CompartmentChangeJournal::division) {
+	    resetAll();
+	    break;
+	  }
+	journalRead_ = journal.numRecord();
+	journal.consumed(journalConsumer_, journalRead_);
+      }
+    }
+    if (numCell < numCell_)
+      resetAll();
+    if (numCell != due_.size()) {
+      due_.resize(numCell, 0);
+      volume_.resize(numCell, 0.0);
+      time_.resize(numCell, 0);
+      randomDue_.resize(numCell, 0);
+    }
+    numCell_ = numCell;
+  }
+
+  ///
+  /// @brief Returns true if the volume of cell i should be calculated at this check.
+  ///
+  bool due(size_t i) const { return due_[i] <= now_; }
+
+  ///
+  /// @brief Records the volume of cell i and schedules its next check for the threshold.
+  ///
+  void observe(size_t i, double volume, double threshold)
+  {
+    double rate = 0.0;
+    if (time_[i] > 0 && time_[i] < now_ && volume_[i] > 0.0 && volume > 0.0)
+      rate = std::log(volume/volume_[i]) / double(now_-time_[i]);
+    volume_[i] = volume;
+    time_[i] = now_;
+    size_t skip = 1;
+    if (rate > 0.0 && volume < threshold) {
+      double numCheck = safety_ * std::log(threshold/volume) / rate;
+      skip = numCheck < double(maxSkip_) ? size_t(numCheck) : maxSkip_;
+      if (skip < 1)
+	skip = 1;
+    }
+    due_[i] = now_+skip;
+  }
+
+  ///
+  /// @brief Forgets the prediction for cell i, e.g. after it has divided.
+  ///
+  void reset(size_t i)
+  {
+    if (i < due_.size()) {
+      due_[i] = 0;
+      time_[i] = 0;
+    }
+  }
+
+  ///
+  /// @brief Returns true if a random event with probability p per check happens for cell i
+  /// at this check, sampling the check of the following event when it does.
+  ///
+  bool randomEvent(size_t i, double p)
+  {
+    if (randomDue_[i] == 0)
+      randomDue_[i] = now_-1+geometric(p);
+    if (randomDue_[i] > now_)
+      return false;
+    randomDue_[i] = now_+geometric(p);
+    return true;
+  }
+
+  size_t now() const { return now_; }
+
+  void writeState(CheckpointBuffer &buffer) const
+  {
+    buffer.put(static_cast<unsigned long long>(now_));
+    buffer.put(static_cast<unsigned long long>(lastCell_));
+    buffer.put(static_cast<unsigned long long>(numCell_));
+    buffer.put(due_);
+    buffer.put(volume_);
+    buffer.put(time_);
+    buffer.put(randomDue_);
+  }
+
+  void readState(CheckpointBuffer &buffer)
+  {
+    unsigned long long n[3];
+    for (size_t k=0; k<3; ++k)
+      buffer.get(n[k]);
+    now_ = n[0];
+    lastCell_ = n[1];
+    numCell_ = n[2];
+    buffer.get(due_);
+    buffer.get(volume_);
+    buffer.get(time_);
+    buffer.get(randomDue_);
+    if (journalConsumer_ != none) {
+      CompartmentChangeJournal &journal = CompartmentChangeJournal::instance();
+      journalRead_ = journal.numRecord();
+      journal.consumed(journalConsumer_, journalRead_);
+    }
+  }
+
+  ///
+  /// @brief Number of checks to the next event, from the geometric distribution on 1,2,...
+  ///
+  static size_t geometric(double p)
+  {
+    if (p >= 1.0)
+      return 1;
+    if (p <= 0.0)
+      return std::numeric_limits<size_t>::max()/2;
+    double u = 1.0-myRandom::Rnd(); // in (0,1]
+    double k = std::floor(std::log(u)/std::log(1.0-p));
+    return k < double(std::numeric_limits<size_t>::max()/4) ? 1+size_t(k) :
+      std::numeric_limits<size_t>::max()/2;
+  }
+
+ private:
+
+  static const size_t none = static_cast<size_t>(-1);
+
+  ///
+  /// @brief Forgets all predictions, after the cells have been given new indices.
+  ///
+  void resetAll()
+  {
+    due_.clear();
+    volume_.clear();
+    time_.clear();
+    randomDue_.clear();
+  }
+
+  double safety_;
+  size_t maxSkip_;
+  size_t now_;
+  size_t lastCell_;
+  size_t numCell_;
+  std::vector<size_t> due_;
+  std::vector<double> volume_;
+  std::vector<size_t> time_;
+  std::vector<size_t> randomDue_;
+  size_t journalConsumer_;
+  size_t journalRead_;
+};
+
+#endif
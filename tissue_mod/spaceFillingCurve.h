@@ -0,0 +1,122 @@
+//
+// Filename     : spaceFillingCurve.h
+// Description  : Space-filling curve orderings for restoring memory locality of tissue data
+// Revision     : $Id:$
+//
+#ifndef SPACEFILLINGCURVE_H
+#define SPACEFILLINGCURVE_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "myTypedefs.h"
+
+///
+/// @brief Namespace for space-filling curve renumbering of cells, walls and vertices.
+///
+/// Divisions append new cells, walls and vertices at the end of the data, such that after a
+/// few generations neighbours are far apart in memory. Ordering positions along a Hilbert
+/// curve (2D) or Morton curve (3D) and permuting the data accordingly restores locality for
+/// loops over walls and cell vertices.
+///
+/// Orders are returned as order[newIndex] = oldIndex, and permuteRows() applies them to a
+/// data matrix. The Tissue itself is not renumbered, since its cells, walls and vertices
+/// point to each other and Tissue has no setters for these pointers; the effect of the
+/// orders is measured on a standalone tissue by benchmark/renumberingBenchmark.cc.
+///
+namespace SpaceFillingCurve {
+
+  ///
+  /// @brief Hilbert curve index of the cell (x,y) in a 2^order x 2^order grid.
+  ///
+  inline unsigned long long hilbert2(unsigned long x, unsigned long y, unsigned order)
+  {
+    unsigned long long d = 0;
+    for (unsigned long s = 1UL << (order-1); s > 0; s >>= 1) {
+      unsigned long rx = (x & s) > 0;
+      unsigned long ry = (y & s) > 0;
+      d += static_cast<unsigned long long>(s) * s * ((3 * rx) ^ ry);
+      // rotate quadrant
+      if (ry == 0) {
+	if (rx == 1) {
+	  x = s-1 - (x & (s-1));
+	  y = s-1 - (y & (s-1));
+	}
+	std::swap(x, y);
+      }
+    }
+    return d;
+  }
+
+  ///
+  /// @brief Morton (z-order) index from interleaving the bits of (x,y,z), 21 bits each.
+  ///
+  inline unsigned long long morton3(unsigned long x, unsigned long y, unsigned long z)
+  {
+    unsigned long long d = 0;
+    for (unsigned b = 0; b < 21; ++b) {
+      d |= static_cast<unsigned long long>((x >> b) & 1UL) << (3*b);
+      d |= static_cast<unsigned long long>((y >> b) & 1UL) << (3*b+1);
+      d |= static_cast<unsigned long long>((z >> b) & 1UL) << (3*b+2);
+    }
+    return d;
+  }
+
+  ///
+  /// @brief Order of positions (rows of a DataMatrix-like matrix) along the curve.
+  ///
+  /// Hilbert curve on a 2^16 grid for two dimensions, Morton curve on a 2^21 grid for three,
+  /// over the bounding box of the positions.
+  ///
+  template<class Matrix>
+  std::vector<size_t> curveOrder(const Matrix &position)
+  {
+    size_t n = position.size();
+    std::vector<size_t> order(n);
+    if (n == 0)
+      return order;
+    size_t dimension = position[0].size() < 3 ? 2 : 3;
+    double pMin[3], pMax[3];
+    for (size_t d = 0; d < dimension; ++d)
+      pMin[d] = pMax[d] = position[0][d];
+    for (size_t i = 1; i < n; ++i)
+      for (size_t d = 0; d < dimension; ++d) {
+	pMin[d] = std::min(pMin[d], double(position[i][d]));
+	pMax[d] = std::max(pMax[d], double(position[i][d]));
+      }
+    unsigned bits = dimension == 2 ? 16 : 21;
+    double numCell = double((1UL << bits) - 1);
+    std::vector< std::pair<unsigned long long, size_t> > key(n);
+    for (size_t i = 0; i < n; ++i) {
+      unsigned long c[3] = {0, 0, 0};
+      for (size_t d = 0; d < dimension; ++d)
+	if (pMax[d] > pMin[d])
+	  c[d] = static_cast<unsigned long>(numCell * (position[i][d]-pMin[d]) / (pMax[d]-pMin[d]));
+      key[i].first = dimension == 2 ? hilbert2(c[0], c[1], bits) : morton3(c[0], c[1], c[2]);
+      key[i].second = i;
+    }
+    std::sort(key.begin(), key.end());
+    for (size_t i = 0; i < n; ++i)
+      order[i] = key[i].second;
+    return order;
+  }
+
+  ///
+  /// @brief Permutes the rows of a matrix, row newIndex being old row order[newIndex].
+  ///
+  /// Rows are copied into new allocations made in the new order, such that also the row
+  /// storage (not only the row pointers) follows the curve.
+  ///
+  inline void permuteRows(DataMatrix &matrix, const std::vector<size_t> &order)
+  {
+    DataMatrix tmp;
+    tmp.reserve(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      tmp.push_back(matrix[order[i]]);
+    matrix.swap(tmp);
+  }
+
+} //end namespace SpaceFillingCurve
+
+#endif
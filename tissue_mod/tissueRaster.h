@@ -0,0 +1,324 @@
+//
+// Filename     : tissueRaster.h
+// Description  : Scanline rasterization of tissue cells into label and wall images
+// Revision     : $Id:$
+//
+#ifndef TISSUERASTER_H
+#define TISSUERASTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tissue.h"
+
+///
+/// @brief Paints the cells of a tissue (projected on the xy-plane) as a label image and a
+/// wall image, as a replacement for rendering meshes and segmenting the rendering.
+///
+/// Each cell polygon is filled by scanlines at pixel centres with half-open crossings, such
+/// that cells sharing walls cover each pixel exactly once and the label image holds the
+/// exact cell identities (cell index+1, 0 outside the tissue). The wall image is the
+/// membrane signal of an imaging system: walls of width wallThickness (pixels) blurred by a
+/// Gaussian point spread of width blur (pixels), with anti-aliased edges for blur 0.
+///
+/// Cells are painted by numThread threads (0 for all cores) in one pass: a thread fills the
+/// pixels of its cell and the signal of the cell walls on these pixels only, such that no
+/// pixel is written by two threads. The signal of the tissue boundary outside the cells is
+/// added afterwards. Cell vertices are expected in polygon order, as kept by Tissue.
+///
+/// The scale is resolution pixels per length unit, or fitted such that the longer side of
+/// the image is size pixels when size is set, with a margin of border pixels.
+///
+class TissueRaster {
+
+ public:
+
+  TissueRaster(double resolution=1.0, double wallThickness=1.0, double blur=0.0, size_t size=0,
+	       size_t border=0, size_t numThread=0)
+    : resolution_(resolution), wallThickness_(wallThickness), blur_(blur), size_(size),
+      border_(border), numThread_(numThread), width_(0), height_(0), numCell_(0) {}
+
+  ///
+  /// @brief Paints the cells of T, with vertex positions from vertexData.
+  ///
+  template<class Matrix>
+  void render(Tissue &T, const Matrix &vertexData)
+  {
+    std::vector< std::vector<size_t> > cellVertex(T.numCell());
+    for (size_t i=0; i<T.numCell(); ++i) {
+      Cell &cell = T.cell(i);
+      cellVertex[i].resize(cell.numVertex());
+      for (size_t k=0; k<cell.numVertex(); ++k)
+	cellVertex[i][k] = cell.vertex(k)->index();
+    }
+    render(cellVertex, vertexData);
+  }
+
+  ///
+  /// @brief Paints the polygons given by the vertex indices of each cell.
+  ///
+  template<class Matrix>
+  void render(const std::vector< std::vector<size_t> > &cellVertex, const Matrix &vertexData)
+  {
+    numCell_ = cellVertex.size();
+    setFrame(vertexData);
+    label_.assign(width_*height_, 0);
+    wall_.assign(width_*height_, 0);
+    x_.resize(vertexData.size());
+    y_.resize(vertexData.size());
+    for (size_t v=0; v<vertexData.size(); ++v) {
+      x_[v] = (vertexData[v][0]-originX_)*resolution_;
+      y_[v] = (vertexData[v][1]-originY_)*resolution_;
+    }
+
+    size_t numThread = numThread_ ? numThread_ : std::thread::hardware_concurrency();
+    numThread = std::max<size_t>(1, std::min(numThread, numCell_/64+1));
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> thread;
+    for (size_t t=0; t<numThread; ++t)
+      thread.push_back(std::thread([&]() {
+	    std::vector<Span> span;
+	    std::vector<double> crossing;
+	    for (size_t begin=next.fetch_add(64); begin<numCell_; begin=next.fetch_add(64))
+	      for (size_t i=begin; i<std::min(begin+64, numCell_); ++i)
+		paintCell(i, cellVertex[i], span, crossing);
+	  }));
+    for (size_t t=0; t<thread.size(); ++t)
+      thread[t].join();
+    paintBoundary(cellVertex);
+  }
+
+  size_t width() const { return width_; }
+  size_t height() const { return height_; }
+  double resolution() const { return resolution_; }
+
+  ///
+  /// @brief Position (length units) of the corner of pixel (0,0), pixel x along the x axis.
+  ///
+  double originX() const { return originX_; }
+  double originY() const { return originY_; }
+
+  /// @brief Cell index+1 per pixel (row major), 0 outside the cells.
+  const std::vector<unsigned int>& label() const { return label_; }
+  /// @brief Wall signal per pixel (row major), 0-255.
+  const std::vector<unsigned char>& wall() const { return wall_; }
+
+  ///
+  /// @brief Writes the label image as a 16-bit binary PGM (cv2.IMREAD_UNCHANGED reads it).
+  ///
+  void writeLabel(const std::string &fileName) const
+  {
+    if (numCell_ > 65535) {
+      std::cerr << "TissueRaster::writeLabel() " << numCell_
+		<< " cells do not fit in a 16-bit label image." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::vector<unsigned char> data(2*label_.size());
+    for (size_t p=0; p<label_.size(); ++p) {
+      data[2*p] = static_cast<unsigned char>(label_[p] >> 8);
+      data[2*p+1] = static_cast<unsigned char>(label_[p] & 255);
+    }
+    writePgm(fileName, 65535, data);
+  }
+
+  ///
+  /// @brief Writes the wall image as an 8-bit binary PGM.
+  ///
+  void writeWall(const std::string &fileName) const
+  {
+    writePgm(fileName, 255, wall_);
+  }
+
+ private:
+
+  struct Span {
+    size_t row, begin, end;
+  };
+
+  template<class Matrix>
+  void setFrame(const Matrix &vertexData)
+  {
+    double minX = HUGE_VAL, maxX = -HUGE_VAL, minY = HUGE_VAL, maxY = -HUGE_VAL;
+    for (size_t v=0; v<vertexData.size(); ++v) {
+      minX = std::min(minX, vertexData[v][0]);
+      maxX = std::max(maxX, vertexData[v][0]);
+      minY = std::min(minY, vertexData[v][1]);
+      maxY = std::max(maxY, vertexData[v][1]);
+    }
+    if (!vertexData.size())
+      minX = maxX = minY = maxY = 0.0;
+    double extent = std::max(maxX-minX, maxY-minY);
+    if (size_ > 2*border_ && extent > 0.0)
+      resolution_ = (size_-2*border_)/extent;
+    if (!(resolution_ > 0.0)) {
+      std::cerr << "TissueRaster::render() Resolution must be positive." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    width_ = size_t(std::ceil((maxX-minX)*resolution_)) + 2*border_;
+    height_ = size_t(std::ceil((maxY-minY)*resolution_)) + 2*border_;
+    if (size_) {
+      width_ = std::min(width_, size_);
+      height_ = std::min(height_, size_);
+    }
+    originX_ = minX - border_/resolution_;
+    originY_ = minY - border_/resolution_;
+  }
+
+  ///
+  /// @brief Wall signal at distance d (pixels) from the wall centre line.
+  ///
+  double signal(double d) const
+  {
+    double r = 0.5*wallThickness_;
+    if (blur_ > 0.0) {
+      double s = std::sqrt(2.0)*blur_;
+      return 0.5*(std::erf((r-d)/s) + std::erf((r+d)/s));
+    }
+    return std::min(1.0, std::max(0.0, r+0.5-d));
+  }
+
+  double reach() const { return 0.5*wallThickness_ + 3.0*blur_ + 1.0; }
+
+  // Adds the signal of the edge (a,b) to the pixels of the rows and columns within reach
+  // accepted by inside(row, column)
+  template<class Inside>
+  void paintEdge(size_t a, size_t b, Inside inside)
+  {
+    double ax = x_[a], ay = y_[a], bx = x_[b], by = y_[b];
+    double ex = bx-ax, ey = by-ay, length2 = ex*ex+ey*ey, margin = reach();
+    long r0 = std::max(0L, long(std::floor(std::min(ay, by)-margin)));
+    long r1 = std::min(long(height_)-1, long(std::ceil(std::max(ay, by)+margin)));
+    long c0 = std::max(0L, long(std::floor(std::min(ax, bx)-margin)));
+    long c1 = std::min(long(width_)-1, long(std::ceil(std::max(ax, bx)+margin)));
+    for (long r=r0; r<=r1; ++r)
+      for (long c=c0; c<=c1; ++c) {
+	if (!inside(size_t(r), size_t(c)))
+	  continue;
+	double px = c+0.5-ax, py = r+0.5-ay;
+	double t = length2 > 0.0 ? std::min(1.0, std::max(0.0, (px*ex+py*ey)/length2)) : 0.0;
+	double dx = px-t*ex, dy = py-t*ey;
+	double value = 255.0*signal(std::sqrt(dx*dx+dy*dy));
+	unsigned char &pixel = wall_[size_t(r)*width_+size_t(c)];
+	if (value > pixel)
+	  pixel = static_cast<unsigned char>(value+0.5 < 255.0 ? value+0.5 : 255.0);
+      }
+  }
+
+  void paintCell(size_t i, const std::vector<size_t> &vertex, std::vector<Span> &span,
+		 std::vector<double> &crossing)
+  {
+    size_t n = vertex.size();
+    if (n < 3)
+      return;
+    double minY = HUGE_VAL, maxY = -HUGE_VAL;
+    for (size_t k=0; k<n; ++k) {
+      minY = std::min(minY, y_[vertex[k]]);
+      maxY = std::max(maxY, y_[vertex[k]]);
+    }
+    // Rows with centres in [minY,maxY)
+    long r0 = std::max(0L, long(std::ceil(minY-0.5)));
+    long r1 = std::min(long(height_), long(std::ceil(maxY-0.5)));
+    span.clear();
+    for (long r=r0; r<r1; ++r) {
+      double yc = r+0.5;
+      crossing.clear();
+      for (size_t k=0; k<n; ++k) {
+	double ay = y_[vertex[k]], by = y_[vertex[(k+1)%n]];
+	if ((ay <= yc) != (by <= yc)) {
+	  double ax = x_[vertex[k]], bx = x_[vertex[(k+1)%n]];
+	  crossing.push_back(ax + (yc-ay)*(bx-ax)/(by-ay));
+	}
+      }
+      std::sort(crossing.begin(), crossing.end());
+      for (size_t k=0; k+1<crossing.size(); k+=2) {
+	// Columns with centres in [crossing[k],crossing[k+1])
+	long c0 = std::max(0L, long(std::ceil(crossing[k]-0.5)));
+	long c1 = std::min(long(width_), long(std::ceil(crossing[k+1]-0.5)));
+	if (c0 >= c1)
+	  continue;
+	Span s = {size_t(r), size_t(c0), size_t(c1)};
+	span.push_back(s);
+	std::fill(label_.begin()+r*width_+c0, label_.begin()+r*width_+c1,
+		  static_cast<unsigned int>(i+1));
+      }
+    }
+    if (span.empty())
+      return;
+    // Walls on the pixels of the cell
+    for (size_t k=0; k<n; ++k)
+      paintEdge(vertex[k], vertex[(k+1)%n], [&](size_t r, size_t c) {
+	  return r >= span.front().row && r <= span.back().row && ownSpan(span, r, c);
+	});
+  }
+
+  // Pixels of other cells may be written by other threads, so ownership of a pixel is
+  // decided by the spans of the cell instead of the label image
+  static bool ownSpan(const std::vector<Span> &span, size_t r, size_t c)
+  {
+    std::vector<Span>::const_iterator s =
+      std::lower_bound(span.begin(), span.end(), r, [](const Span &a, size_t row) {
+	  return a.row < row;
+	});
+    for (; s!=span.end() && s->row == r; ++s)
+      if (c >= s->begin && c < s->end)
+	return true;
+    return false;
+  }
+
+  // Signal of the walls of the tissue boundary (edges of one cell only) outside the cells
+  void paintBoundary(const std::vector< std::vector<size_t> > &cellVertex)
+  {
+    std::vector< std::pair<size_t, size_t> > edge;
+    for (size_t i=0; i<cellVertex.size(); ++i)
+      for (size_t k=0; k<cellVertex[i].size(); ++k) {
+	size_t a = cellVertex[i][k], b = cellVertex[i][(k+1)%cellVertex[i].size()];
+	edge.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+      }
+    std::sort(edge.begin(), edge.end());
+    for (size_t k=0; k<edge.size(); ) {
+      size_t l = k;
+      while (l < edge.size() && edge[l] == edge[k])
+	++l;
+      if (l == k+1)
+	paintEdge(edge[k].first, edge[k].second, [&](size_t r, size_t c) {
+	    return label_[r*width_+c] == 0;
+	  });
+      k = l;
+    }
+  }
+
+  void writePgm(const std::string &fileName, int maxValue,
+		const std::vector<unsigned char> &data) const
+  {
+    std::ofstream OUT(fileName.c_str(), std::ios::binary);
+    if (!OUT) {
+      std::cerr << "TissueRaster::writePgm() Cannot open file " << fileName << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    OUT << "P5\n" << width_ << " " << height_ << "\n" << maxValue << "\n";
+    OUT.write(reinterpret_cast<const char*>(data.data()), data.size());
+  }
+
+  double resolution_;
+  double wallThickness_;
+  double blur_;
+  size_t size_;
+  size_t border_;
+  size_t numThread_;
+  size_t width_, height_;
+  size_t numCell_;
+  double originX_, originY_;
+  std::vector<double> x_, y_;
+  std::vector<unsigned int> label_;
+  std::vector<unsigned char> wall_;
+};
+
+#endif
@@ -0,0 +1,244 @@
+//
+// Filename     : watershed.cc
+// Description  : Priority-flood watershed of masked 8-bit images with tile-parallel markers
+// Revision     : $Id:$
+//
+// Compile as a shared library next to improc_to_graphs.py, which then uses it instead of
+// skimage.segmentation.watershed:
+//
+//   g++ -O2 -shared -fPIC -pthread watershed.cc -o libwatershed.so
+//
+// The watershed is the one of skimage.segmentation.watershed without markers: markers are
+// the regional minima (4-connected plateaus without lower neighbours), labelled from 1 in
+// raster order of their first pixel, and basins are flooded 4-connected in order of grey
+// value and then of time of reaching. Pixels outside the elliptic mask (the structuring
+// element of cv2.getStructuringElement(cv2.MORPH_ELLIPSE, ...) placed in the image) are set
+// to 0 instead of multiplying the image, and form the first label.
+//
+// The masking and the search for the markers are split into square tiles processed by a
+// pool of threads: plateaus are joined by union-find inside each tile in parallel, and
+// across the tile seams afterwards (seam merge), such that the markers are the same as for
+// one tile. The flood itself is single-threaded: it is one global priority flood, since a
+// basin can reach any distance across tile borders before its competitors do, so the labels
+// do not depend on the tiles or the number of threads. See native_watershed.py for the
+// Python interface and a benchmark against skimage (1024x1024 synthetic cells: 1.00 s for
+// skimage, 0.040 s here on one core).
+//
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace {
+
+///
+/// @brief FIFO queues per grey level, popped from the lowest level.
+///
+class LevelQueue {
+
+ public:
+
+  LevelQueue() : level_(256), head_(256, 0), current_(256) {}
+
+  void push(unsigned char v, int p)
+  {
+    level_[v].push_back(p);
+    if (v < current_)
+      current_ = v;
+  }
+
+  bool pop(int &p)
+  {
+    while (current_ < 256 && head_[current_] == level_[current_].size()) {
+      level_[current_].clear();
+      head_[current_] = 0;
+      ++current_;
+    }
+    if (current_ == 256)
+      return false;
+    p = level_[current_][head_[current_]++];
+    return true;
+  }
+
+ private:
+
+  std::vector< std::vector<int> > level_;
+  std::vector<size_t> head_;
+  int current_;
+};
+
+struct Region {
+  int y0, y1, x0, x1;
+};
+
+int find(std::vector<int> &parent, int p)
+{
+  while (parent[p] != p) {
+    parent[p] = parent[parent[p]];
+    p = parent[p];
+  }
+  return p;
+}
+
+// Roots are the smallest (first in raster order) pixel of the set
+void join(std::vector<int> &parent, int p, int q)
+{
+  p = find(parent, p);
+  q = find(parent, q);
+  if (p < q)
+    parent[q] = p;
+  else if (q < p)
+    parent[p] = q;
+}
+
+///
+/// @brief Floods the image from its pixels labelled in label, in raster order within each
+/// grey value.
+///
+void flood(const std::vector<unsigned char> &value, int height, int width, int *label)
+{
+  LevelQueue queue;
+  int size = height*width;
+  for (int p=0; p<size; ++p)
+    if (label[p])
+      queue.push(value[p], p);
+  int q;
+  while (queue.pop(q)) {
+    int y = q/width, x = q-y*width;
+    int neighbour[4] = {y ? q-width : -1, x ? q-1 : -1, x+1 < width ? q+1 : -1,
+			y+1 < height ? q+width : -1};
+    for (int k=0; k<4; ++k) {
+      int n = neighbour[k];
+      if (n < 0 || label[n])
+	continue;
+      label[n] = label[q];
+      queue.push(value[n], n);
+    }
+  }
+}
+
+// Runs body(t) for all tiles t on numThread threads
+template<class Body>
+void forTiles(int numTile, int numThread, Body body)
+{
+  std::atomic<int> next(0);
+  std::vector<std::thread> thread;
+  for (int k=0; k<numThread; ++k)
+    thread.push_back(std::thread([&]() {
+	  for (int t=next++; t<numTile; t=next++)
+	    body(t);
+	}));
+  for (size_t k=0; k<thread.size(); ++k)
+    thread[k].join();
+}
+
+}
+
+///
+/// @brief Labels the watershed basins of channel 0 of an 8-bit image.
+///
+/// image points to pixel (0,0) channel 0 with pixelStride bytes between pixels of a row
+/// (the number of channels) and rows stored contiguously. Pixels outside the ellipse of
+/// size maskHeight x maskWidth with top left corner at (maskTop, maskLeft) are set to 0
+/// (no mask if maskHeight is 0). tile is the tile side for the marker search, and numThread
+/// 0 uses all cores. The labels, which do not depend on tile and numThread, are written to
+/// label (height*width) and the number of labels is returned.
+///
+extern "C" int watershed_u8(const unsigned char *image, int height, int width, int pixelStride,
+			    int maskTop, int maskLeft, int maskHeight, int maskWidth,
+			    int tile, int numThread, int *label)
+{
+  if (numThread <= 0)
+    numThread = std::max(1u, std::thread::hardware_concurrency());
+  if (numThread == 1 || tile <= 0)
+    tile = std::max(height, width);
+  int numTileY = (height+tile-1)/tile, numTileX = (width+tile-1)/tile;
+  int numTile = numTileY*numTileX;
+  numThread = std::min(numThread, numTile);
+  size_t size = size_t(height)*width;
+
+  // Ellipse rows as cv2.getStructuringElement(cv2.MORPH_ELLIPSE, (maskWidth, maskHeight))
+  std::vector<int> maskBegin(height, 0), maskEnd(height, maskHeight ? 0 : width);
+  int r = maskHeight/2, c = maskWidth/2;
+  double invR2 = r ? 1.0/(double(r)*r) : 0.0;
+  for (int i=0; i<maskHeight; ++i) {
+    int dy = i-r, y = maskTop+i;
+    if (std::abs(dy) > r || y < 0 || y >= height)
+      continue;
+    int dx = int(std::lrint(c*std::sqrt((r*r-dy*dy)*invR2)));
+    maskBegin[y] = std::max(maskLeft+std::max(c-dx, 0), 0);
+    maskEnd[y] = std::min(maskLeft+std::min(c+dx+1, maskWidth), width);
+  }
+
+  std::vector<unsigned char> value(size);
+  std::vector<int> parent(size);
+  std::vector<unsigned char> lower(size);
+  std::vector<Region> core(numTile);
+  for (int t=0; t<numTile; ++t) {
+    int ty = t/numTileX, tx = t%numTileX;
+    Region &rg = core[t];
+    rg.y0 = ty*tile; rg.y1 = std::min(rg.y0+tile, height);
+    rg.x0 = tx*tile; rg.x1 = std::min(rg.x0+tile, width);
+  }
+
+  // Masked values
+  forTiles(numTile, numThread, [&](int t) {
+      const Region &rg = core[t];
+      for (int y=rg.y0; y<rg.y1; ++y)
+	for (int x=rg.x0; x<rg.x1; ++x)
+	  value[size_t(y)*width+x] = x >= maskBegin[y] && x < maskEnd[y] ?
+	    image[(size_t(y)*width+x)*pixelStride] : 0;
+    });
+
+  // Plateaus within tiles, and pixels with a lower neighbour
+  forTiles(numTile, numThread, [&](int t) {
+      const Region &rg = core[t];
+      for (int y=rg.y0; y<rg.y1; ++y)
+	for (int x=rg.x0; x<rg.x1; ++x) {
+	  int p = y*width+x;
+	  parent[p] = p;
+	  unsigned char v = value[p];
+	  lower[p] = (y && value[p-width] < v) || (x && value[p-1] < v) ||
+	    (x+1 < width && value[p+1] < v) || (y+1 < height && value[p+width] < v);
+	}
+      for (int y=rg.y0; y<rg.y1; ++y)
+	for (int x=rg.x0; x<rg.x1; ++x) {
+	  int p = y*width+x;
+	  if (x+1 < rg.x1 && value[p+1] == value[p])
+	    join(parent, p, p+1);
+	  if (y+1 < rg.y1 && value[p+width] == value[p])
+	    join(parent, p, p+width);
+	}
+    });
+
+  // Seam merge of the plateaus
+  for (int x=tile; x<width; x+=tile)
+    for (int y=0; y<height; ++y) {
+      int p = y*width+x;
+      if (value[p-1] == value[p])
+	join(parent, p-1, p);
+    }
+  for (int y=tile; y<height; y+=tile)
+    for (int x=0; x<width; ++x) {
+      int p = y*width+x;
+      if (value[p-width] == value[p])
+	join(parent, p-width, p);
+    }
+
+  // Markers: plateaus without lower neighbours, numbered in raster order
+  std::vector<int> markerLabel(size, 1);
+  for (size_t p=0; p<size; ++p)
+    if (lower[p])
+      markerLabel[find(parent, int(p))] = 0;
+  int numLabel = 0;
+  for (size_t p=0; p<size; ++p) {
+    int root = find(parent, int(p));
+    if (root == int(p) && markerLabel[p])
+      markerLabel[p] = ++numLabel;
+    label[p] = markerLabel[root];
+  }
+
+  flood(value, height, width, label);
+  return numLabel;
+}